@@ -1,669 +1,9153 @@
-#include <iostream>
-#include <vector>
-#include <string>
-#include <ctime>
-#include <cstring>
-#include <fstream>
-
-using namespace std;
-
-// Define steps
-class Step {
-public:
-    virtual void execute() = 0;
-    virtual void writeOutput(FILE *fName) = 0;
-};
-
-class TitleStep : public Step {
-private:
-    string title, subtitle;
-
-public:
-    TitleStep(const string& t, const string& st) : title(t), subtitle(st) {}
-
-    void execute() override {
-        cout << "Title: " << title << "\nSubtitle: " << subtitle << endl;
-    }
-
-    void writeOutput(FILE *fName) override {
-        fprintf(fName, "Title: %s\nSubtitle: %s\n", title.c_str(), subtitle.c_str());
-    }
-};
-
-class TextStep : public Step {
-private:
-    string title, copy;
-    
-public:
-    TextStep(const string& t, const string& c) : title(t), copy(c) {}
-    
-    void execute() override {
-        cout << "Title: " << title << "\nCopy: " << copy << endl;
-    }
-
-    void writeOutput(FILE *fName) override {
-        try {
-            fprintf(fName, "Title: %s\nCopy: %s\n", title.c_str(), copy.c_str());
-        } catch (const std::exception& e) {
-            std::cerr << "Error writing to the file: " << e.what() << std::endl;
-        }
-    }
-
-};
-
-class TextInputStep : public Step {
-private:
-    string description;
-
-public:
-    TextInputStep(const string& desc) : description(desc) {}
-
-    void execute() override {
-        string input;
-        cout << description << ": ";
-        cin >> input;
-    }
-
-    void writeOutput(FILE *fName) override {
-        fprintf(fName, "%s: ", description.c_str());
-    }
-};
-
-class NumberInputStep : public Step {
-private:
-    string description;
-    int numberInput;
-
-public:
-    NumberInputStep(const string& desc, int num) : description(desc), numberInput(num) {}
-
-    void execute() override {
-        cout << description << ": " << numberInput << endl;
-    }
-
-    int getNumber() {
-        return numberInput;
-    }
-
-    void writeOutput(FILE *fName) override {
-    try {
-        fprintf(fName, "%s: %d\n", description.c_str(), numberInput);
-    } catch (const std::exception& e) {
-        std::cerr << "Error writing to the file: " << e.what() << std::endl;
-    }
-}
-    
-};
-
-class CalculusStep : public Step {
-private:
-    int numbersFromSteps[3];
-    char operation;
-    float result;
-
-public:
-    CalculusStep(int s[3], const char op) : operation(op) {
-        for (int i = 0; i < 3; ++i) {
-            numbersFromSteps[i] = s[i];
-        }
-    }
-
-    void execute() override {
-        cout << "The result is: ";
-
-        switch (operation) {
-            case '+':
-                result = numbersFromSteps[0] + numbersFromSteps[1];
-                break;
-
-            case '-':
-                result = numbersFromSteps[0] - numbersFromSteps[1];
-                break;
-
-            case '*':
-                result = numbersFromSteps[0] * numbersFromSteps[1];
-                break;
-
-            case '/':
-                if (numbersFromSteps[1] != 0) {
-                    result = numbersFromSteps[0] / numbersFromSteps[1];
-                } else {
-                    std::cout << "Error: Division by zero!" << std::endl;
-                }
-                break;
-
-            case 'm':
-                result = std::min(numbersFromSteps[0], numbersFromSteps[1]);
-                break;
-
-            case 'M':
-                result = std::max(numbersFromSteps[0], numbersFromSteps[1]);
-                break;
-
-            default:
-                std::cout << "Invalid operation!" << std::endl;
-        }
-
-        cout << result << endl;
-    }
-
-    void writeOutput(FILE *fName) override {
-    try {
-        fprintf(fName, "The result is: %f\n", result);
-    } catch (const std::exception& e) {
-        std::cerr << "Error writing to the file: " << e.what() << std::endl;
-    }
-}
-};
-
-class DisplayStep : public Step {
-private:
-    string fName;
-
-public:
-    DisplayStep(string& s) : fName(s) {}
-
-    void execute() override {
-        // Check if the file with .txt extension exists
-        if (fileExists(fName + ".txt")) {
-            fName += ".txt";
-            displayFileContents();
-            return;
-        }
-
-        // Check if the file with .csv extension exists
-        if (fileExists(fName + ".csv")) {
-            fName += ".csv";
-            displayFileContents();
-            return;
-        }
-
-        // If file doesn't exist with either .txt or .csv extension
-        std::cerr << "File '" << fName << "' not found.\n";
-    }
-
-    void writeOutput(FILE *outputFile) override {
-        // Open the input file for reading
-        if (fileExists(fName + ".txt")) {
-            fName += ".txt";
-        } else if (fileExists(fName + ".csv")) {
-            fName += ".csv";
-        }
-
-        FILE *inputFile = fopen(fName.c_str(), "r"); // Open the concatenated filename in read mode
-
-        if (inputFile && outputFile) { // Ensure both files are open
-            char line[512]; // Buffer to hold each line
-
-            fprintf(outputFile, "Content of file '%s':\n", fName.c_str()); // Write header
-
-            // Read each line from the input file and write it to the output file
-            while (fgets(line, sizeof(line), inputFile)) {
-                fprintf(outputFile, "%s", line);
-            }
-
-            // Close the files
-            fclose(inputFile);
-            fclose(outputFile);
-
-            std::cout << "Content of file '" << fName << "' written to the output file successfully.\n";
-        } else {
-            std::cerr << "Unable to open either file '" << fName << "' or the provided output file.\n";
-        }
-    }
-
-private:
-    // Helper function to check if file exists
-    bool fileExists(const std::string& filename) const {
-        std::ifstream file(filename.c_str());
-        return file.good();
-    }
-
-    // Helper function to display file contents
-    void displayFileContents() const {
-        std::ifstream inFile(fName);
-        
-        if (inFile.is_open()) {
-            std::string line;
-            
-            std::cout << "Content of file '" << fName << "':\n";
-            while (std::getline(inFile, line)) {
-                std::cout << line << '\n';
-            }
-            
-            inFile.close();
-        } else {
-            std::cerr << "Unable to open file '" << fName << "'.\n";
-        }
-    }
-};
-
-class TextFileInputStep : public Step {
-private:
-    string description, fileName;
-
-public:
-    TextFileInputStep(const string& desc, const string& fName) : description(desc), fileName(fName + ".txt") {}
-
-    void execute() override {
-        // Create or append to the TXT file based on your requirements
-        std::ofstream outFile(fileName);  // Create or overwrite the file
-
-        if (outFile.is_open()) {
-            // Write TXT data (for demonstration)
-            outFile << "it works!\n";
-            outFile << "Data1,Data2,Data3\n";
-            
-            outFile.close();
-            std::cout << "TXT file '" << fileName << "' created successfully.\n";
-        } else {
-            std::cerr << "Unable to create/open TXT file '" << fileName << "'.\n";
-        }
-    }
-
-    void writeOutput(FILE *fName) override {
-        fprintf(fName, "%s: ", description.c_str());
-    }
-};
-
-class CsvFileInputStep : public Step {
-private:
-    string description, fileName;
-
-public:
-    CsvFileInputStep(const std::string& desc, const std::string& fName)
-        : description(desc), fileName(fName + ".csv") {}
-
-    void execute() override {
-        // Create or append to the CSV file based on your requirements
-        std::ofstream outFile(fileName);  // Create or overwrite the file
-
-        if (outFile.is_open()) {
-            // Write CSV header and data (for demonstration)
-            outFile << "Header1,Header2,Header3\n";
-            outFile << "Data1,Data2,Data3\n";
-            
-            outFile.close();
-            std::cout << "CSV file '" << fileName << "' created successfully.\n";
-        } else {
-            std::cerr << "Unable to create/open CSV file '" << fileName << "'.\n";
-        }
-    }
-
-    void writeOutput(FILE *fName) override {
-        fprintf(fName, "%s: ", description.c_str());
-    }
-};
-
-class OutputStep : public Step {
-private:
-    string fName, title, description, information;
-
-public:
-    OutputStep(const string& file, const string& t, const string& desc, const string& info) : 
-        fName(file), title(t), description(desc), information(info) {}
-
-    void execute() override {
-        // Create or overwrite the file with the given fName
-        std::ofstream outFile(fName);
-
-        if (outFile.is_open()) {
-            // Write the title, description, and information to the file
-            outFile << "Title: " << title << "\n\n";
-            outFile << "Description: " << description << "\n\n";
-            outFile << "Information: " << information << "\n";
-
-            cout << "File '" << fName << "' created and data written successfully.\n";
-            outFile.close();  // Close the file stream
-        } else {
-            std::cerr << "Unable to create/open file '" << fName << "'.\n";
-        }
-    }
-
-    void writeOutput(FILE *fName) override {
-        fprintf(fName, "");
-    }
-};
-
-class Flow {
-private:
-    string name;
-    vector<Step*> steps;
-    time_t creationTime;
-
-public:
-    Flow(const string& n) : name(n) {
-        creationTime = time(0);  // Current timestamp
-    }
-
-    void addStep(Step* step) {
-        steps.push_back(step);
-    }
-
-    void deleteStep(Step* step) {
-        for (auto it = steps.begin(); it != steps.end(); ++it)
-        {
-            if (*it == step) {
-                steps.erase(it);
-                return;
-            }
-        }
-    }
-
-    void execute() {
-        for (Step* step : steps) {
-            step->execute();
-        }
-    }
-
-    void writeOutput(FILE *fName) {
-        for (Step* step : steps) {
-            step->writeOutput(fName);
-        }
-    }
-
-    string getName(){
-        return name;
-    }
-
-    vector<Step*> getSteps() {
-        return steps;
-    }
-};
-
-int main() {
-    int choice;
-    vector<Flow*> existingFlows; // Vector pentru a stoca flow-urile existente (doar pentru acest exemplu)
-
-invalid_option:
-    while (1)
-    {
-        cout << "To use an existing flow, press 1; to create a new one, press 2; to delete a flow, press 3; and to exit, press 4: ";
-        cin >> choice;
-        switch (choice) {
-            case 1:
-            {
-                if (existingFlows.empty()) {
-                    cout << "There are no available flows for use.\n";
-                } else {
-                    cout << "Choose an existing flow:\n";
-                    for (size_t i = 0; i < existingFlows.size(); ++i) {
-                        cout << i + 1 << ". " << existingFlows[i]->getName() << "\n"; // Presupunând că avem o funcție getName() în clasa Flow
-                    }
-                    int chosenFlow;
-                    cin >> chosenFlow;
-                    if (chosenFlow > 0 && chosenFlow <= existingFlows.size()) {
-                        existingFlows[chosenFlow - 1]->execute();
-                    } else {
-                        cout << "Invalid option.\n";
-                    }
-                }
-                break;
-            }
-            case 2:
-            {
-                cout << "Create a new flow.\n";
-                Flow* newFlow;
-
-                char inputLine[100];
-                int nrSteps = 9;
-                char flowName[50];
-
-                cout << "Please enter the flow name:";
-                cin >> flowName;
-                newFlow = new Flow(flowName); // Alocăm un nou flow dinamic
-                cout << "Available step types: title, text, number, calculation, textfile, csvfile, output, displaytxt, displaycsv, end" << endl;
-                
-                cout << "Do you want to add a title step?" << endl;
-                cout << "1. Add a new title step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                
-                int choice;
-                cin >> choice;
-                if (choice == 1) {
-                    string title, subtitle;
-                    cout << "Enter title: ";
-                    cin >> title;
-                    cout << "Enter subtitle: ";
-                    cin >> subtitle;
-                    // luam flowul nou creat, ii luam vector de steps deja existent, adaugam noul step cerut de utilizator in el
-                    newFlow->addStep(new TitleStep(title, subtitle));
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-
-                cout << "Do you want to add a text step?" << endl;
-                cout << "1. Add a new text step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                cin >> choice;
-
-                if (choice == 1) {
-                    string title, copy;
-                    cout << "Enter title: ";
-                    cin >> title;
-                    cout << "Enter text copy: ";
-                    cin >> copy;
-                    newFlow->addStep(new TextStep(title, copy));
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-
-                cout << "Do you want to add a number step?" << endl;
-                cout << "1. Add a new number step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                cin >> choice;
-
-                if (choice == 1) {
-                    string description;
-                    float num;
-                    cout << "Enter number description: ";
-                    cin >> description;
-                    cout << "Enter a number: ";
-                    cin >> num;
-                    // (*newFlow).getSteps()
-                    newFlow->addStep(new NumberInputStep(description, num));
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-
-                cout << "Do you want to add a number step?" << endl;
-                cout << "1. Add a new number step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                cin >> choice;
-
-                if (choice == 1) {
-                    string description;
-                    float num;
-                    cout << "Enter number description: ";
-                    cin >> description;
-                    cout << "Enter a number: ";
-                    cin >> num;
-                    // (*newFlow).getSteps()
-                    newFlow->addStep(new NumberInputStep(description, num));
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-
-                cout << "Do you want to add a calculus step?" << endl;
-                cout << "1. Add a new calculus step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                cin >> choice;
-
-                if (choice == 1) {
-                    int steps[3];
-                    char operation;
-                    cout << "Enter number of steps: ";
-                    for (int i = 0; i < 2; i++) {
-                        cout << "Number of the " << i << " step:" << endl;
-                        cin >> steps[i];
-                    }
-
-                    int numbersFromSteps[3];
-                    for (int i = 0; i < 2; i++) {
-                        NumberInputStep *numberStep = dynamic_cast<NumberInputStep*>(newFlow->getSteps().at(steps[i]));
-                        numbersFromSteps[i] = numberStep->getNumber();
-                    }
-                    
-                    cout << "Enter operation (e.g., '+' for Addition, '-' for Subtraction, etc...): ";
-                    cin >> operation;
-                    //calculusStep->execute();
-                    newFlow->addStep(new CalculusStep(numbersFromSteps, operation));
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-
-                cout << "Do you want to add a text file step?" << endl;
-                cout << "1. Add a new text file step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                cin >> choice;
-
-                if (choice == 1) {
-                    string desc, fileName;
-                    cout << "Enter file description: ";
-                    cin >> desc;
-                    cout << "Enter file name: ";
-                    cin >> fileName;
-                    TextFileInputStep *textFileInputStep = new TextFileInputStep(desc, fileName);
-                    //textFileInputStep->execute();
-                    newFlow->addStep(textFileInputStep);
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-
-                cout << "Do you want to add a CSV file step?" << endl;
-                cout << "1. Add a new CSV file step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                cin >> choice;
-
-                if (choice == 1) {
-                    string desc, fileName;
-                    cout << "Enter CSV description: ";
-                    cin >> desc;
-                    cout << "Enter CSV file name: ";
-                    cin >> fileName;
-                    CsvFileInputStep *csvFileInputStep = new CsvFileInputStep(desc, fileName);
-                    //csvFileInputStep->execute();
-                    newFlow->addStep(csvFileInputStep);
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-
-                cout << "Do you want to add a displaytxt/displaycsv step?" << endl;
-                cout << "1. Add a new display step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                cin >> choice;
-
-                if (choice == 1) {
-                    string fName;
-                    cout << "Enter file name to display: ";
-                    cin >> fName;
-                    DisplayStep* dispStep = new DisplayStep(fName);
-                    //dispStep->execute();
-                    newFlow->addStep(dispStep);
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-
-                cout << "Do you want to add an output step?" << endl;
-                cout << "1. Add a new output step" << endl;
-                cout << "2. Skip step" << endl;
-                cout << "3. End" << endl;
-                cin >> choice;
-
-                if (choice == 1) {
-                    int stepNum;
-                    string outFile, outTitle, outDesc, outInfo;
-                    cout << "Enter output file name: ";
-                    cin >> outFile;
-                    cout << "Enter output title: ";
-                    cin >> outTitle;
-                    cout << "Enter output description: ";
-                    cin >> outDesc;
-                    
-                    FILE* file = fopen(outFile.c_str(), "w");
-                    newFlow->writeOutput(file);
-                    fclose(file);
-                    newFlow->addStep(new OutputStep(outFile, outTitle, outDesc, outInfo));
-                } else if (choice == 2) {
-                    cout << "Skipping step...\n";
-                } else if (choice == 3) {
-                    existingFlows.push_back(newFlow);
-                    break;
-                }
-                
-                existingFlows.push_back(newFlow); // Adăugăm flow-ul nou creat în vectorul de flow-uri existente
-                break;
-            }
-            case 3:
-            {
-                if (existingFlows.empty()) {
-                    cout << "There are no flows to be deleted.\n";
-                } else {
-                    cout << "Choose a flow to delete it:\n";
-                    for (size_t i = 0; i < existingFlows.size(); ++i) {
-                        cout << i + 1 << ". " << existingFlows[i]->getName() << "\n";
-                    }
-                    int deleteFlow;
-                    cin >> deleteFlow;
-                    if (deleteFlow > 0 && deleteFlow <= existingFlows.size()) {
-                        delete existingFlows[deleteFlow - 1]; // Ștergem flow-ul
-                        existingFlows.erase(existingFlows.begin() + deleteFlow - 1); // Ștergem referința la flow-ul șters din vector
-                        cout << "The flow has been successfully deleted.\n";
-                    } else {
-                        cout << "Invalid option.\n";
-                    }
-                }
-            }
-        }
-
-        if (choice == 4) {
-            cout << "Exit..\n";
-            break;
-        }
-
-        if (choice > 4 || choice <= 0) {
-            cout << "Invalid option, choose again.\n";
-            goto invalid_option;
-        }
-    }
-
-
-    // Eliberăm resursele alocate dinamic (pentru flow-urile rămase)
-    for (Flow* flow : existingFlows) {
-        delete flow;
-    }
-
-    return 0;
+#include <iostream>
+#include <vector>
+#include <string>
+#include <ctime>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <system_error>
+#include <atomic>
+#include <string_view>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <condition_variable>
+#include <algorithm>
+#include <variant>
+#include <tuple>
+#include <array>
+#include <utility>
+#include <unordered_map>
+#include <cstdarg>
+#include <cerrno>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <unistd.h>
+#include <cmath>
+#include <charconv>
+#include <limits>
+#include <climits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define FLOW_COROUTINES 1
+#endif
+
+using namespace std;
+
+// Resource counters
+
+// What the current thread has read, written and allocated so far. The file access code and
+// operator new keep these up to date at the cost of an increment; metrics take the
+// difference around a step to find what the step itself used.
+struct ThreadCounters {
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t allocations;
+};
+
+thread_local ThreadCounters threadCounters;
+
+// The library's operator delete frees with free(), so only allocation needs replacing. It
+// is kept out of line, as the library's is: inlined, the compiler would see malloc() paired
+// with operator delete and warn about a mismatch.
+[[gnu::noinline]] void* operator new(size_t size) {
+    ++threadCounters.allocations;
+    if (void* memory = malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+// File access
+
+// Read-only view of a whole file mapped into memory
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+    bool opened;
+
+public:
+    // Nothing mapped
+    MappedFile() : bytes(nullptr), length(0), opened(false) {}
+
+    MappedFile(const string& path, bool sequential = true) : bytes(nullptr), length(0), opened(false) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) == 0) {
+            length = info.st_size;
+            opened = true;
+            threadCounters.bytesRead += length;
+
+            // An empty file has nothing to map but is still a valid input
+            if (length > 0) {
+                void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED) {
+                    length = 0;
+                    opened = false;
+                } else {
+                    bytes = static_cast<const char*>(mapped);
+                    madvise(mapped, length, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                }
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (bytes) {
+            munmap(const_cast<char*>(bytes), length);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const {
+        return opened;
+    }
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+// Bounded single-producer, single-consumer channel of fixed-size chunks, through which one
+// step streams bytes to another instead of through a file. The CHUNKS chunks are allocated
+// once and cycle between the two ends: the producer fills a free chunk and publishes it,
+// the consumer reads it and hands it back. A producer CHUNKS chunks ahead waits for the
+// consumer (backpressure) and a consumer waits for the producer, both on one condition
+// variable, so a stream of any length passes in CHUNKS * CHUNK_SIZE bytes of memory. The
+// lock is only taken to hand over a whole chunk, never while one is filled or read. Either
+// end may cancel: the producer then gets no more chunks and the consumer no more data.
+class ChunkChannel {
+public:
+    static constexpr size_t CHUNK_SIZE = 256 << 10;
+    static const size_t CHUNKS = 8;
+
+private:
+    unique_ptr<char[]> storage;
+    size_t sizes[CHUNKS];
+    std::mutex lock;
+    std::condition_variable changed;
+    uint64_t produced, consumed; // chunks published and handed back so far
+    bool closed, cancelled;
+
+public:
+    ChunkChannel()
+        : storage(new char[CHUNKS * CHUNK_SIZE]), produced(0), consumed(0), closed(false), cancelled(false) {}
+
+    ChunkChannel(const ChunkChannel&) = delete;
+    ChunkChannel& operator=(const ChunkChannel&) = delete;
+
+    // Producer: the chunk to fill next, up to CHUNK_SIZE bytes, waiting while every chunk is
+    // in use; nullptr once the channel is cancelled
+    char* acquire() {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return cancelled || produced - consumed < CHUNKS; });
+        return cancelled ? nullptr : &storage[(produced % CHUNKS) * CHUNK_SIZE];
+    }
+
+    // Producer: pass on the chunk from acquire(), holding size bytes
+    void publish(size_t size) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            sizes[produced % CHUNKS] = size;
+            ++produced;
+        }
+        changed.notify_all();
+    }
+
+    // Producer: nothing follows the chunks published so far
+    void close() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        changed.notify_all();
+    }
+
+    // Consumer: the next chunk, valid until release(), waiting for the producer; false at
+    // the end of the stream or once it is cancelled
+    bool next(string_view& chunk) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return cancelled || closed || produced > consumed; });
+        if (cancelled || produced == consumed) {
+            return false;
+        }
+        chunk = string_view(&storage[(consumed % CHUNKS) * CHUNK_SIZE], sizes[consumed % CHUNKS]);
+        return true;
+    }
+
+    // Consumer: hand the chunk from next() back to the producer
+    void release() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ++consumed;
+        }
+        changed.notify_all();
+    }
+
+    void cancel() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            cancelled = true;
+        }
+        changed.notify_all();
+    }
+};
+
+// Zero-copy CSV reader. Rows are parsed straight out of the mapped file and every field is
+// a string_view into the mapping, so reading a row allocates nothing once the field vector
+// has grown to the widest row. Quoted fields may contain delimiters, newlines and doubled
+// quotes; they are returned without their surrounding quotes, and unquote() turns the
+// doubled quotes back into plain text when a caller needs it.
+//
+// A reader can also take its text from a ChunkChannel. The chunks are appended to a window
+// that keeps only the row being parsed, and fields are then valid until the next row only.
+class CsvReader {
+private:
+    MappedFile file;
+    shared_ptr<ChunkChannel> channel;
+    string window;
+    bool streamEnded;
+    char delimiter;
+    size_t position;
+    size_t rowStart;
+    vector<string_view> rowFields;
+    vector<bool> rowQuoted;
+
+public:
+    // A reader that jumps between rows with seek() should map the file for random access
+    CsvReader(const string& path, char delim = ',', bool sequential = true)
+        : file(path, sequential), streamEnded(true), delimiter(delim), position(0), rowStart(0) {}
+
+    CsvReader(shared_ptr<ChunkChannel> source, char delim = ',')
+        : channel(std::move(source)), streamEnded(false), delimiter(delim), position(0), rowStart(0) {}
+
+    bool isOpen() const {
+        return channel || file.isOpen();
+    }
+
+    // Parse the next row; returns false at the end of the file. A row of a stream that runs
+    // into the end of the window may go on in the next chunk, so it is parsed again once
+    // that has arrived.
+    bool nextRow() {
+        while (true) {
+            bool reachedEnd;
+            bool found = parseRow(reachedEnd);
+            if (streamEnded || (found && !reachedEnd)) {
+                return found;
+            }
+            position = rowStart;
+            refill();
+        }
+    }
+
+private:
+    bool parseRow(bool& reachedEnd) {
+        rowFields.clear();
+        rowQuoted.clear();
+
+        const char* begin = data();
+        const char* end = begin + length();
+        const char* p = begin + position;
+
+        rowStart = position;
+        reachedEnd = p >= end;
+        if (p >= end) {
+            return false;
+        }
+
+        while (true) {
+            const char* fieldStart = p;
+            const char* fieldEnd;
+            bool quoted = p < end && *p == '"';
+
+            if (quoted) {
+                // Closing quote is one not followed by another quote
+                ++fieldStart;
+                const char* q = fieldStart;
+                while (true) {
+                    q = static_cast<const char*>(memchr(q, '"', end - q));
+                    if (!q || q + 1 >= end || q[1] != '"') {
+                        break;
+                    }
+                    q += 2;
+                }
+                fieldEnd = q ? q : end;
+                p = findSeparator(q ? q + 1 : end, end);
+            } else {
+                p = findSeparator(p, end);
+                fieldEnd = p;
+            }
+
+            // Drop the CR of a CRLF line ending
+            if (!quoted && fieldEnd > fieldStart && fieldEnd[-1] == '\r' && (p == end || *p == '\n')) {
+                --fieldEnd;
+            }
+
+            rowFields.emplace_back(fieldStart, fieldEnd - fieldStart);
+            rowQuoted.push_back(quoted);
+
+            if (p == end || *p == '\n') {
+                reachedEnd = p == end;
+                position = (p == end ? end : p + 1) - begin;
+                return true;
+            }
+            ++p; // skip the delimiter
+        }
+    }
+
+    const char* data() const {
+        return channel ? window.data() : file.data();
+    }
+
+    size_t length() const {
+        return channel ? window.size() : file.size();
+    }
+
+    // Drop the rows already parsed from the window and append the next chunk of the stream
+    void refill() {
+        window.erase(0, position);
+        position = rowStart = 0;
+        string_view chunk;
+        if (!channel->next(chunk)) {
+            streamEnded = true;
+            return;
+        }
+        window.append(chunk);
+        channel->release();
+    }
+
+public:
+
+    const vector<string_view>& fields() const {
+        return rowFields;
+    }
+
+    bool isQuoted(size_t field) const {
+        return rowQuoted[field];
+    }
+
+    // Turn the doubled quotes of a quoted field back into single ones
+    static string unquote(string_view field) {
+        string text;
+        text.reserve(field.size());
+        for (size_t i = 0; i < field.size(); ++i) {
+            text += field[i];
+            if (field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"') {
+                ++i;
+            }
+        }
+        return text;
+    }
+
+    // Text of the last row read, as it is in the file but without its line ending
+    string_view rowText() const {
+        string_view text(data() + rowStart, position - rowStart);
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+
+    // A field as a number; NaN when it is empty or not a number
+    static double parseNumber(string_view field) {
+        while (!field.empty() && (field.front() == ' ' || field.front() == '+')) {
+            field.remove_prefix(1);
+        }
+        double value;
+        auto parsed = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (field.empty() || parsed.ec != std::errc()) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return value;
+    }
+
+    // Bytes consumed so far, for progress reporting
+    size_t offset() const {
+        return position;
+    }
+
+    // Where the last row read starts, which seek() can return to
+    size_t rowOffset() const {
+        return rowStart;
+    }
+
+    // Continue reading at a byte offset, which must be the start of a row
+    void seek(size_t offset) {
+        position = std::min(offset, length());
+    }
+
+    size_t size() const {
+        return length();
+    }
+
+private:
+    // Find the next delimiter or newline, 16 bytes at a time where SSE2 is available
+    const char* findSeparator(const char* p, const char* end) const {
+#if defined(__SSE2__)
+        const __m128i delims = _mm_set1_epi8(delimiter);
+        const __m128i newlines = _mm_set1_epi8('\n');
+
+        while (end - p >= 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, delims),
+                                                      _mm_cmpeq_epi8(chunk, newlines)));
+            if (mask) {
+                return p + __builtin_ctz(mask);
+            }
+            p += 16;
+        }
+#endif
+        while (p < end && *p != delimiter && *p != '\n') {
+            ++p;
+        }
+        return p;
+    }
+};
+
+// Copy the rest of one descriptor to another without passing the data through user space
+// where the kernel allows it: copy_file_range() between regular files, sendfile() to
+// anything else (pipes, terminals, sockets), and a large-buffer read/write loop otherwise.
+// Both descriptors advance by the amount copied.
+bool copyDescriptor(int in, int out) {
+    const size_t chunk = 1 << 30;
+    ssize_t n;
+
+    while ((n = copy_file_range(in, nullptr, out, nullptr, chunk, 0)) > 0) {
+        threadCounters.bytesRead += n;
+        threadCounters.bytesWritten += n;
+    }
+    if (n == 0) {
+        return true;
+    }
+    if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF) {
+        return false;
+    }
+
+    while ((n = sendfile(out, in, nullptr, chunk)) > 0) {
+        threadCounters.bytesRead += n;
+        threadCounters.bytesWritten += n;
+    }
+    if (n == 0) {
+        return true;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return false;
+    }
+
+    vector<char> buffer(1 << 20);
+    while ((n = read(in, buffer.data(), buffer.size())) > 0) {
+        threadCounters.bytesRead += n;
+        threadCounters.bytesWritten += n;
+        for (ssize_t done = 0; done < n;) {
+            ssize_t written = write(out, buffer.data() + done, n - done);
+            if (written < 0) {
+                return false;
+            }
+            done += written;
+        }
+    }
+    return n == 0;
+}
+
+// Buffered destination for flow reports. Text is appended to a large reusable buffer and
+// only reaches the file when the buffer fills up or on flush(). Plain strings are copied in
+// without any formatting; printf() is there for the few fields that need it. With a
+// background writer, full buffers are handed to a thread that does the write() calls, so
+// the caller never waits for the disk; written buffers are recycled instead of freed. A
+// sink into a ChunkChannel fills its chunks instead of writing a file, and closes the
+// channel when it closes.
+class OutputSink {
+private:
+    int fd;
+    bool ownsFd;
+    shared_ptr<ChunkChannel> channel;
+    bool failed;
+    size_t capacity;
+    string buffer;
+
+    // Background writer state
+    std::thread writer;
+    std::mutex queueLock;
+    std::condition_variable queueChanged;
+    std::deque<string> queued;
+    vector<string> spare;
+    bool writing;
+    bool stopping;
+
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+    OutputSink(const string& path, bool background = false, size_t bufferSize = DEFAULT_CAPACITY)
+        : fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)), ownsFd(true) {
+        start(background, bufferSize);
+        if (fd < 0) {
+            std::cerr << "Unable to create/open file '" << path << "'.\n";
+        }
+    }
+
+    OutputSink(int descriptor, bool background = false, size_t bufferSize = DEFAULT_CAPACITY)
+        : fd(descriptor), ownsFd(false) {
+        start(background, bufferSize);
+    }
+
+    OutputSink(shared_ptr<ChunkChannel> target) : fd(-1), ownsFd(false), channel(std::move(target)) {
+        start(false, ChunkChannel::CHUNK_SIZE);
+    }
+
+    ~OutputSink() {
+        close();
+    }
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    bool isOpen() const {
+        return (fd >= 0 || channel) && !failed;
+    }
+
+    // Descriptor of the destination, valid for direct writes only right after flush()
+    int descriptor() const {
+        return fd;
+    }
+
+    void write(const char* data, size_t size) {
+        if (!channel) {
+            threadCounters.bytesWritten += size;
+        }
+        if (buffer.size() + size > capacity) {
+            handOff();
+            // Anything at least as large as the buffer goes straight through
+            if (size >= capacity) {
+                flush();
+                writeAll(data, size);
+                return;
+            }
+        }
+        buffer.append(data, size);
+    }
+
+    // Append the rest of an open file, copied inside the kernel after the buffered text
+    bool copyFrom(int in) {
+        flush();
+        if (channel) {
+            return copyToChannel(in);
+        }
+        return isOpen() && copyDescriptor(in, fd);
+    }
+
+    OutputSink& operator<<(string_view text) {
+        write(text.data(), text.size());
+        return *this;
+    }
+
+    OutputSink& operator<<(char c) {
+        write(&c, 1);
+        return *this;
+    }
+
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char small[256];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(small, sizeof(small), format, args);
+        va_end(args);
+
+        if (length < 0) {
+            return;
+        }
+        if ((size_t)length < sizeof(small)) {
+            write(small, length);
+            return;
+        }
+
+        string large(length + 1, '\0');
+        va_start(args, format);
+        vsnprintf(&large[0], large.size(), format, args);
+        va_end(args);
+        write(large.data(), length);
+    }
+
+    // Write out everything buffered so far and wait until it is on its way to the file
+    void flush() {
+        handOff();
+        if (writer.joinable()) {
+            std::unique_lock<std::mutex> guard(queueLock);
+            queueChanged.wait(guard, [this] { return queued.empty() && !writing; });
+        }
+    }
+
+    void close() {
+        if (channel) {
+            flush();
+            channel->close();
+            channel.reset();
+            return;
+        }
+        if (fd < 0) {
+            return;
+        }
+        flush();
+        if (writer.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(queueLock);
+                stopping = true;
+            }
+            queueChanged.notify_all();
+            writer.join();
+        }
+        if (ownsFd) {
+            ::close(fd);
+        }
+        fd = -1;
+    }
+
+private:
+    void start(bool background, size_t bufferSize) {
+        failed = false;
+        capacity = std::max<size_t>(bufferSize, 4096);
+        writing = false;
+        stopping = false;
+        buffer.reserve(capacity);
+        if (background && fd >= 0) {
+            writer = std::thread(&OutputSink::writerLoop, this);
+        }
+    }
+
+    // Pass the current buffer on: to the writer thread if there is one, else to the file
+    void handOff() {
+        if (buffer.empty()) {
+            return;
+        }
+        if (!writer.joinable()) {
+            writeAll(buffer.data(), buffer.size());
+            buffer.clear();
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(queueLock);
+        queued.push_back(std::move(buffer));
+        if (spare.empty()) {
+            buffer = string();
+            buffer.reserve(capacity);
+        } else {
+            buffer = std::move(spare.back());
+            spare.pop_back();
+        }
+        queueChanged.notify_all();
+    }
+
+    void writerLoop() {
+        std::unique_lock<std::mutex> guard(queueLock);
+        while (true) {
+            queueChanged.wait(guard, [this] { return stopping || !queued.empty(); });
+            if (queued.empty()) {
+                return;
+            }
+
+            string chunk = std::move(queued.front());
+            queued.pop_front();
+            writing = true;
+            guard.unlock();
+
+            writeAll(chunk.data(), chunk.size());
+            chunk.clear();
+
+            guard.lock();
+            spare.push_back(std::move(chunk));
+            writing = false;
+            queueChanged.notify_all();
+        }
+    }
+
+    void writeAll(const char* data, size_t size) {
+        // A cancelled stream has no reader left, which is not worth a message
+        while (channel && size > 0 && !failed) {
+            char* chunk = channel->acquire();
+            if (!chunk) {
+                failed = true;
+                return;
+            }
+            size_t length = std::min(size, ChunkChannel::CHUNK_SIZE);
+            memcpy(chunk, data, length);
+            channel->publish(length);
+            data += length;
+            size -= length;
+        }
+        while (size > 0 && fd >= 0 && !failed) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Error writing to the file: " << strerror(errno) << std::endl;
+                failed = true;
+                return;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    // Read the rest of a file straight into chunks of the channel
+    bool copyToChannel(int in) {
+        while (!failed) {
+            char* chunk = channel->acquire();
+            if (!chunk) {
+                failed = true;
+                break;
+            }
+            ssize_t n = read(in, chunk, ChunkChannel::CHUNK_SIZE);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return n == 0;
+            }
+            threadCounters.bytesRead += n;
+            channel->publish(n);
+        }
+        return false;
+    }
+};
+
+// Fingerprint of a file on disk: changes whenever it is replaced or modified
+string fileFingerprint(const string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return "missing";
+    }
+    return to_string(info.st_dev) + ":" + to_string(info.st_ino) + ":" + to_string(info.st_size) + ":" +
+           to_string(info.st_mtim.tv_sec) + "." + to_string(info.st_mtim.tv_nsec);
+}
+
+// Saved step results and sidecars are flat bytes in native byte order, read back front
+// to back
+void appendBytes(string& blob, const void* data, size_t size) {
+    blob.append(static_cast<const char*>(data), size);
+}
+
+void appendString(string& blob, const string& text) {
+    uint32_t size = text.size();
+    appendBytes(blob, &size, 4);
+    blob += text;
+}
+
+bool takeBytes(string_view& blob, void* data, size_t size) {
+    if (blob.size() < size) {
+        return false;
+    }
+    memcpy(data, blob.data(), size);
+    blob.remove_prefix(size);
+    return true;
+}
+
+bool takeString(string_view& blob, string& text) {
+    uint32_t size;
+    if (!takeBytes(blob, &size, 4) || blob.size() < size) {
+        return false;
+    }
+    text.assign(blob.data(), size);
+    blob.remove_prefix(size);
+    return true;
+}
+
+// Columnar sidecars
+//
+// Typed, compressed copy of a CSV file kept next to it in <file>.cols, written the first
+// time the CSV is read and used instead of parsing its text for as long as the CSV is
+// unchanged. A column holds numbers if every field is a number or empty, text otherwise.
+// Rows are cut into blocks, and every block of every column is stored in the smallest of a
+// few encodings along with the min and max of its values (as numbers). A block holds up to
+// 64K rows, so reading a column through the mapping touches only its own pages, and a
+// range search skips the blocks whose min and max rule them out. Blocks are written out as
+// soon as they are encoded and located through a footer, so writing a sidecar keeps only
+// one block per column and the text dictionaries in memory. A text column's dictionary is
+// read the first time one of its values is asked for. Integers are stored in native byte
+// order, as in flow catalogs.
+//
+//   header   "FLOWCOL2"
+//   data     per block of rows, the encoded block of every column in turn; then every
+//            text column's dictionary, u32 size and bytes per entry
+//   footer   u32 column count, u32 block rows, u64 row count, u32 size and text of the
+//            CSV's fingerprint, then per column: u32 name size, name, u8 type, u32
+//            dictionary size, u64 dictionary offset, and per block: u64 offset, u32 size,
+//            u8 encoding, f64 min, f64 max
+//   trailer  u64 footer offset
+//
+// Numbers are raw doubles, zigzag varint deltas when they are all integers, or runs of
+// (f64 value, u32 count). Text is dictionary codes: a width byte and codes of 1, 2 or 4
+// bytes each, or runs of (u32 code, u32 count).
+class ColumnStore {
+public:
+    enum Type : uint8_t { NUMBER, TEXT };
+
+private:
+    enum Encoding : uint8_t { RAW, DELTA, RUNS, CODES, CODE_RUNS };
+
+    static const uint32_t BLOCK_ROWS = 65536;
+
+    struct Block {
+        uint64_t offset;
+        uint32_t size;
+        Encoding encoding;
+        double min, max;
+    };
+
+    struct Column {
+        Type type;
+        vector<Block> blocks;
+        uint32_t dictionarySize;
+        uint64_t dictionaryOffset;
+    };
+
+    unique_ptr<MappedFile> file;
+    vector<string> header;
+    vector<Column> columns;
+    uint64_t rows;
+    uint32_t blockRows;
+
+    // Dictionary entries as numbers, per column, read on first use
+    mutable std::mutex dictionaryLock;
+    mutable vector<shared_ptr<const vector<double>>> dictionaries;
+
+public:
+    ColumnStore() : rows(0), blockRows(BLOCK_ROWS) {}
+
+    // The sidecar of a CSV file, written first if it is missing or no longer matches the
+    // CSV (unless build is false); nullptr when there is none and it cannot be written.
+    // A build that failed is not tried again while the CSV keeps the same fingerprint.
+    static shared_ptr<const ColumnStore> forCsv(const string& csvPath, bool build = true) {
+        string fingerprint = fileFingerprint(csvPath);
+        if (fingerprint == "missing") {
+            return nullptr;
+        }
+
+        string sidecar = csvPath + ".cols";
+        auto store = make_shared<ColumnStore>();
+        if (store->open(sidecar, fingerprint)) {
+            return store;
+        }
+        if (!build || failedBuild(csvPath, fingerprint)) {
+            return nullptr;
+        }
+        if (write(csvPath, sidecar, fingerprint) && store->open(sidecar, fingerprint)) {
+            return store;
+        }
+        failedBuild(csvPath, fingerprint, true);
+        return nullptr;
+    }
+
+    const vector<string>& getHeader() const {
+        return header;
+    }
+
+    uint64_t rowCount() const {
+        return rows;
+    }
+
+    Type type(size_t column) const {
+        return columns[column].type;
+    }
+
+    // Every value of a column as CsvReader::parseNumber() reads it, so text that is not a
+    // number is NaN
+    void readNumbers(size_t column, vector<double>& out) const {
+        const Column& source = columns[column];
+        shared_ptr<const vector<double>> dictionary = dictionaryNumbers(column);
+        out.resize(rows);
+        for (size_t b = 0; b < source.blocks.size(); ++b) {
+            decode(source.blocks[b], *dictionary, &out[b * blockRows], blockLength(b));
+        }
+    }
+
+    // Rows (counted from 0, after the header) whose value in a column lies in [low, high]
+    vector<uint64_t> rowsBetween(size_t column, double low, double high) const {
+        const Column& source = columns[column];
+        shared_ptr<const vector<double>> dictionary = dictionaryNumbers(column);
+        vector<double> values(blockRows);
+        vector<uint64_t> found;
+        for (size_t b = 0; b < source.blocks.size(); ++b) {
+            const Block& block = source.blocks[b];
+            if (block.max < low || block.min > high) {
+                continue;
+            }
+            size_t length = blockLength(b);
+            decode(block, *dictionary, values.data(), length);
+            for (size_t i = 0; i < length; ++i) {
+                if (values[i] >= low && values[i] <= high) {
+                    found.push_back((uint64_t)b * blockRows + i);
+                }
+            }
+        }
+        return found;
+    }
+
+private:
+    size_t blockLength(size_t block) const {
+        return std::min<uint64_t>(blockRows, rows - (uint64_t)block * blockRows);
+    }
+
+    // Whether building the sidecar of csvPath failed for this fingerprint; with failed set,
+    // record that it did
+    static bool failedBuild(const string& csvPath, const string& fingerprint, bool failed = false) {
+        static std::mutex lock;
+        static map<string, string> failures;
+        std::lock_guard<std::mutex> guard(lock);
+        if (failed) {
+            failures[csvPath] = fingerprint;
+            return true;
+        }
+        auto known = failures.find(csvPath);
+        return known != failures.end() && known->second == fingerprint;
+    }
+
+    // The dictionary of a column as numbers, read from the mapping the first time it is
+    // needed. Entries past a damaged one are left out, so their codes decode as NaN.
+    shared_ptr<const vector<double>> dictionaryNumbers(size_t column) const {
+        std::lock_guard<std::mutex> guard(dictionaryLock);
+        if (dictionaries[column]) {
+            return dictionaries[column];
+        }
+
+        const Column& source = columns[column];
+        auto numbers = make_shared<vector<double>>();
+        uint64_t offset = std::min<uint64_t>(source.dictionaryOffset, file->size());
+        const char* p = file->data() + offset;
+        const char* end = file->data() + file->size();
+        numbers->reserve(std::min<uint64_t>(source.dictionarySize, (end - p) / 4));
+        for (uint32_t d = 0; d < source.dictionarySize; ++d) {
+            uint32_t size;
+            if ((size_t)(end - p) < 4 || (memcpy(&size, p, 4), (size_t)(end - p - 4) < size)) {
+                break;
+            }
+            numbers->push_back(CsvReader::parseNumber(string_view(p + 4, size)));
+            p += 4 + size;
+        }
+        dictionaries[column] = numbers;
+        return numbers;
+    }
+
+    void decode(const Block& block, const vector<double>& dictionary, double* out, size_t length) const {
+        const char* p = file->data() + block.offset;
+        const char* end = p + block.size;
+        size_t i = 0;
+
+        auto code = [&](uint32_t c) {
+            return c < dictionary.size() ? dictionary[c] : std::numeric_limits<double>::quiet_NaN();
+        };
+
+        switch (block.encoding) {
+            case RAW:
+                memcpy(out, p, std::min<size_t>(block.size, length * 8));
+                i = block.size / 8;
+                break;
+            case DELTA: {
+                int64_t value = 0;
+                while (i < length && p < end) {
+                    uint64_t zigzag = 0;
+                    for (int shift = 0; p < end; shift += 7) {
+                        unsigned char byte = *p++;
+                        zigzag |= (uint64_t)(byte & 0x7f) << shift;
+                        if (!(byte & 0x80)) {
+                            break;
+                        }
+                    }
+                    value += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+                    out[i++] = (double)value;
+                }
+                break;
+            }
+            case RUNS:
+            case CODE_RUNS:
+                for (; end - p >= (block.encoding == RUNS ? 12 : 8);) {
+                    double value;
+                    uint32_t count;
+                    if (block.encoding == RUNS) {
+                        memcpy(&value, p, 8);
+                        p += 8;
+                    } else {
+                        uint32_t c;
+                        memcpy(&c, p, 4);
+                        p += 4;
+                        value = code(c);
+                    }
+                    memcpy(&count, p, 4);
+                    p += 4;
+                    for (uint32_t r = 0; r < count && i < length; ++r) {
+                        out[i++] = value;
+                    }
+                }
+                break;
+            case CODES: {
+                size_t width = p < end ? (unsigned char)*p++ : 4;
+                for (; i < length && (size_t)(end - p) >= width && width <= 4; p += width) {
+                    uint32_t c = 0;
+                    memcpy(&c, p, width);
+                    out[i++] = code(c);
+                }
+                break;
+            }
+        }
+
+        // A damaged block reads as missing values rather than garbage
+        for (; i < length; ++i) {
+            out[i] = std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+
+    bool open(const string& path, const string& fingerprint) {
+        unique_ptr<MappedFile> mapped(new MappedFile(path, false));
+        if (!mapped->isOpen() || mapped->size() < 16 || memcmp(mapped->data(), "FLOWCOL2", 8) != 0) {
+            return false;
+        }
+
+        uint64_t footer;
+        memcpy(&footer, mapped->data() + mapped->size() - 8, 8);
+        if (footer < 8 || footer > mapped->size() - 8) {
+            return false;
+        }
+        const char* p = mapped->data() + footer;
+        const char* end = mapped->data() + mapped->size() - 8;
+        auto take = [&](void* target, size_t size) {
+            if ((size_t)(end - p) < size) {
+                return false;
+            }
+            memcpy(target, p, size);
+            p += size;
+            return true;
+        };
+        auto takeText = [&](string& text) {
+            uint32_t size;
+            if (!take(&size, 4) || (size_t)(end - p) < size) {
+                return false;
+            }
+            text.assign(p, size);
+            p += size;
+            return true;
+        };
+
+        uint32_t columnCount;
+        string stored;
+        if (!take(&columnCount, 4) || !take(&blockRows, 4) || !take(&rows, 8) || !takeText(stored) ||
+            stored != fingerprint || blockRows == 0) {
+            return false;
+        }
+
+        // Every column takes at least 17 bytes of footer and every block 29
+        size_t blockCount = (rows + blockRows - 1) / blockRows;
+        if (columnCount > (size_t)(end - p) / 17 || blockCount > (size_t)(end - p) / 29) {
+            return false;
+        }
+        header.assign(columnCount, "");
+        columns.assign(columnCount, Column());
+        for (uint32_t c = 0; c < columnCount; ++c) {
+            Column& column = columns[c];
+            if (!takeText(header[c]) || !take(&column.type, 1) || !take(&column.dictionarySize, 4) ||
+                !take(&column.dictionaryOffset, 8)) {
+                return false;
+            }
+            column.blocks.resize(blockCount);
+            for (Block& block : column.blocks) {
+                if (!take(&block.offset, 8) || !take(&block.size, 4) || !take(&block.encoding, 1) ||
+                    !take(&block.min, 8) || !take(&block.max, 8) || block.offset > footer ||
+                    block.size > footer - block.offset) {
+                    return false;
+                }
+            }
+        }
+
+        dictionaries.assign(columnCount, nullptr);
+        file = std::move(mapped);
+        return true;
+    }
+
+    // Fields of one column while writing: numbers, or dictionary codes for text
+    struct ColumnWriter {
+        Type type;
+        vector<Block> blocks;
+        std::deque<string> entries;
+        std::unordered_map<string_view, uint32_t> codes;
+        vector<double> entryNumbers;
+        vector<double> numbers;
+        vector<uint32_t> blockCodes;
+    };
+
+    // Convert csvPath to a sidecar that atomically replaces sidecarPath
+    static bool write(const string& csvPath, const string& sidecarPath, const string& fingerprint) {
+        CsvReader reader(csvPath);
+        if (!reader.isOpen() || !reader.nextRow()) {
+            return false;
+        }
+        vector<string> names;
+        for (size_t i = 0; i < reader.fields().size(); ++i) {
+            string_view name = reader.fields()[i];
+            names.push_back(reader.isQuoted(i) ? CsvReader::unquote(name) : string(name));
+        }
+
+        // A first pass finds the type of every column
+        vector<ColumnWriter> writers(names.size());
+        vector<bool> numeric(names.size(), true);
+        while (reader.nextRow()) {
+            const vector<string_view>& row = reader.fields();
+            for (size_t c = 0; c < names.size() && c < row.size(); ++c) {
+                if (numeric[c] && !row[c].empty() && std::isnan(CsvReader::parseNumber(row[c]))) {
+                    numeric[c] = false;
+                }
+            }
+        }
+        for (size_t c = 0; c < names.size(); ++c) {
+            writers[c].type = numeric[c] ? NUMBER : TEXT;
+        }
+
+        // Blocks go to the file as soon as they are encoded, the footer last
+        string temporary = sidecarPath + ".tmp." + to_string(getpid()) + "." + to_string(syscall(SYS_gettid));
+        bool ok;
+        {
+            OutputSink out(temporary);
+            uint64_t offset = 0;
+            auto put = [&](const string& bytes) {
+                out.write(bytes.data(), bytes.size());
+                offset += bytes.size();
+            };
+            put(string("FLOWCOL2", 8));
+
+            CsvReader rowReader(csvPath);
+            rowReader.nextRow();
+            uint64_t rowCount = 0;
+            string encoded;
+            bool more = out.isOpen();
+            while (more) {
+                size_t length = 0;
+                while (length < BLOCK_ROWS && (more = rowReader.nextRow())) {
+                    const vector<string_view>& row = rowReader.fields();
+                    for (size_t c = 0; c < names.size(); ++c) {
+                        string_view field = c < row.size() ? row[c] : string_view();
+                        ColumnWriter& writer = writers[c];
+                        if (writer.type == NUMBER) {
+                            writer.numbers.push_back(CsvReader::parseNumber(field));
+                            continue;
+                        }
+
+                        string unquoted;
+                        if (c < row.size() && rowReader.isQuoted(c) && field.find('"') != string_view::npos) {
+                            unquoted = CsvReader::unquote(field);
+                            field = unquoted;
+                        }
+                        auto known = writer.codes.find(field);
+                        if (known == writer.codes.end()) {
+                            writer.entries.emplace_back(field);
+                            writer.entryNumbers.push_back(CsvReader::parseNumber(field));
+                            known = writer.codes.emplace(writer.entries.back(), writer.entries.size() - 1).first;
+                        }
+                        writer.blockCodes.push_back(known->second);
+                    }
+                    ++length;
+                }
+
+                if (length > 0) {
+                    for (ColumnWriter& writer : writers) {
+                        encodeBlock(writer, offset, encoded);
+                        put(encoded);
+                    }
+                    rowCount += length;
+                }
+            }
+
+            // Dictionaries, in pieces of about 1 MB
+            vector<uint64_t> dictionaryOffsets(names.size(), 0);
+            string piece;
+            for (size_t c = 0; c < names.size(); ++c) {
+                dictionaryOffsets[c] = offset + piece.size();
+                for (const string& entry : writers[c].entries) {
+                    appendString(piece, entry);
+                    if (piece.size() >= (1 << 20)) {
+                        put(piece);
+                        piece.clear();
+                    }
+                }
+            }
+            put(piece);
+
+            string footer;
+            uint64_t footerOffset = offset;
+            uint32_t columnCount = names.size(), blockRows = BLOCK_ROWS;
+            appendBytes(footer, &columnCount, 4);
+            appendBytes(footer, &blockRows, 4);
+            appendBytes(footer, &rowCount, 8);
+            appendString(footer, fingerprint);
+            for (size_t c = 0; c < names.size(); ++c) {
+                const ColumnWriter& writer = writers[c];
+                appendString(footer, names[c]);
+                footer += (char)writer.type;
+                uint32_t entries = writer.entries.size();
+                appendBytes(footer, &entries, 4);
+                appendBytes(footer, &dictionaryOffsets[c], 8);
+                for (const Block& block : writer.blocks) {
+                    appendBytes(footer, &block.offset, 8);
+                    appendBytes(footer, &block.size, 4);
+                    appendBytes(footer, &block.encoding, 1);
+                    appendBytes(footer, &block.min, 8);
+                    appendBytes(footer, &block.max, 8);
+                }
+            }
+            appendBytes(footer, &footerOffset, 8);
+            put(footer);
+
+            out.flush();
+            ok = out.isOpen();
+        }
+
+        ok = ok && rename(temporary.c_str(), sidecarPath.c_str()) == 0;
+        if (!ok) {
+            unlink(temporary.c_str());
+        }
+        return ok;
+    }
+
+    // Encode the values gathered for one block, to be written at offset, in the smallest
+    // encoding, and record the block with their range
+    static void encodeBlock(ColumnWriter& writer, uint64_t offset, string& best) {
+        Block block;
+        block.offset = offset;
+        block.min = std::numeric_limits<double>::infinity();
+        block.max = -std::numeric_limits<double>::infinity();
+        auto cover = [&](double value) {
+            if (!std::isnan(value)) {
+                block.min = std::min(block.min, value);
+                block.max = std::max(block.max, value);
+            }
+        };
+
+        string candidate;
+        best.clear();
+        if (writer.type == NUMBER) {
+            const vector<double>& values = writer.numbers;
+            bool integers = true;
+            for (double value : values) {
+                cover(value);
+                integers = integers && value == std::trunc(value) && std::fabs(value) < 9007199254740992.0 &&
+                           !(value == 0 && std::signbit(value));
+            }
+
+            block.encoding = RAW;
+            appendBytes(best, values.data(), values.size() * 8);
+
+            for (size_t i = 0; i < values.size();) {
+                uint32_t count = 1;
+                while (i + count < values.size() && memcmp(&values[i + count], &values[i], 8) == 0) {
+                    ++count;
+                }
+                appendBytes(candidate, &values[i], 8);
+                appendBytes(candidate, &count, 4);
+                i += count;
+            }
+            if (candidate.size() < best.size()) {
+                best.swap(candidate);
+                block.encoding = RUNS;
+            }
+
+            if (integers) {
+                candidate.clear();
+                int64_t previous = 0;
+                for (double value : values) {
+                    int64_t delta = (int64_t)value - previous;
+                    previous = (int64_t)value;
+                    for (uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);; zigzag >>= 7) {
+                        if (zigzag < 0x80) {
+                            candidate += (char)zigzag;
+                            break;
+                        }
+                        candidate += (char)((zigzag & 0x7f) | 0x80);
+                    }
+                }
+                if (candidate.size() < best.size()) {
+                    best.swap(candidate);
+                    block.encoding = DELTA;
+                }
+            }
+            writer.numbers.clear();
+        } else {
+            const vector<uint32_t>& codes = writer.blockCodes;
+            uint32_t largest = 0;
+            for (uint32_t code : codes) {
+                cover(writer.entryNumbers[code]);
+                largest = std::max(largest, code);
+            }
+
+            block.encoding = CODES;
+            char width = largest < 0x100 ? 1 : largest < 0x10000 ? 2 : 4;
+            best += width;
+            for (uint32_t code : codes) {
+                appendBytes(best, &code, width);
+            }
+            for (size_t i = 0; i < codes.size();) {
+                uint32_t count = 1;
+                while (i + count < codes.size() && codes[i + count] == codes[i]) {
+                    ++count;
+                }
+                appendBytes(candidate, &codes[i], 4);
+                appendBytes(candidate, &count, 4);
+                i += count;
+            }
+            if (candidate.size() < best.size()) {
+                best.swap(candidate);
+                block.encoding = CODE_RUNS;
+            }
+            writer.blockCodes.clear();
+        }
+
+        block.size = best.size();
+        writer.blocks.push_back(block);
+    }
+};
+
+// Numeric columns of a CSV file, parsed the first time a step asks for them and then
+// shared by every step reading the same column. Fields that are not numbers read as NaN.
+class CsvTable {
+private:
+    string fileName;
+    vector<string> header;
+    shared_ptr<const ColumnStore> store;
+    std::mutex lock;
+    map<string, shared_ptr<const vector<double>>> columns;
+
+public:
+    // With a columnar sidecar of the file, columns are read from it instead of the text
+    CsvTable(const string& file, const vector<string>& names, shared_ptr<const ColumnStore> sidecar = nullptr)
+        : fileName(file), header(names), store(std::move(sidecar)) {}
+
+    const vector<string>& getHeader() const {
+        return header;
+    }
+
+    const string& getFileName() const {
+        return fileName;
+    }
+
+    // Values of the named column, or nullptr if the file has no such column
+    shared_ptr<const vector<double>> column(const string& name) {
+        std::lock_guard<std::mutex> guard(lock);
+
+        auto cached = columns.find(name);
+        if (cached != columns.end()) {
+            return cached->second;
+        }
+
+        size_t index = find(header.begin(), header.end(), name) - header.begin();
+        if (index == header.size()) {
+            return nullptr;
+        }
+
+        auto values = make_shared<vector<double>>();
+        if (store) {
+            store->readNumbers(index, *values);
+            columns[name] = values;
+            return values;
+        }
+
+        CsvReader reader(fileName);
+        reader.nextRow(); // header
+        while (reader.nextRow()) {
+            values->push_back(index < reader.fields().size() ? CsvReader::parseNumber(reader.fields()[index])
+                                                             : std::numeric_limits<double>::quiet_NaN());
+        }
+
+        columns[name] = values;
+        return values;
+    }
+};
+
+// Key indexes
+
+// Index of a CSV file on one key column, kept next to it in <file>.<column>.idx and built
+// again whenever the CSV no longer matches the fingerprint stored in it. It holds the byte
+// offset of every data row sorted by key, and a sparse top level with the key of every
+// STRIDE-th row, which is loaded into memory. A search binary-searches the top level and
+// then one stretch of STRIDE offsets, parsing only the rows it probes, so finding a key
+// touches a handful of pages of the CSV however many rows it has. Keys compare as numbers
+// when the column holds only numbers (rows with no key are then left out) and as bytes
+// otherwise. Integers are stored in native byte order, as in columnar sidecars.
+//
+//   header   "FLOWIDX1", u32 size and text of the CSV's fingerprint, u32 size and name of
+//            the column, u32 column position, u8 numeric, u64 row count, u32 stride
+//   offsets  u64 per row, in key order (rows with equal keys in file order)
+//   top      the key of every stride-th row: f64 for numbers, u32 size and bytes for text
+class CsvIndex {
+private:
+    static const uint32_t STRIDE = 256;
+
+    unique_ptr<MappedFile> file;
+    unique_ptr<CsvReader> rows;
+    size_t position;
+    bool numeric;
+    uint64_t count;
+    uint32_t stride;
+    const char* offsets;
+    vector<double> topNumbers;
+    vector<string> topTexts;
+    string unquoted;
+
+public:
+    CsvIndex() : position(0), numeric(false), count(0), stride(STRIDE), offsets(nullptr) {}
+
+    // File holding the index of a column; characters other than letters, digits, '-' and '_'
+    // are replaced in the name, the column name stored inside tells such columns apart
+    static string pathFor(const string& csvPath, const string& column) {
+        string path = csvPath + ".";
+        for (char c : column) {
+            path += isalnum((unsigned char)c) || c == '-' || c == '_' ? c : '_';
+        }
+        return path + ".idx";
+    }
+
+    // Open the index of the column at position in the CSV's header, building it first if it
+    // is missing or stale; false if the CSV cannot be read or the index cannot be written
+    bool open(const string& csvPath, const string& column, size_t columnPosition) {
+        string fingerprint = fileFingerprint(csvPath);
+        if (fingerprint == "missing") {
+            return false;
+        }
+
+        string path = pathFor(csvPath, column);
+        if (!load(path, fingerprint, column, columnPosition) &&
+            !(write(csvPath, path, fingerprint, column, columnPosition) &&
+              load(path, fingerprint, column, columnPosition))) {
+            return false;
+        }
+        rows.reset(new CsvReader(csvPath, ',', false));
+        position = columnPosition;
+        return rows->isOpen();
+    }
+
+    bool isNumeric() const {
+        return numeric;
+    }
+
+    uint64_t rowCount() const {
+        return count;
+    }
+
+    // Offsets of the rows whose key lies in [low, high], in key order
+    void offsetsBetween(double low, double high, vector<uint64_t>& out) {
+        auto probe = [&](uint64_t entry) {
+            return numberAt(entry);
+        };
+        append(bound(topNumbers, low, false, probe), bound(topNumbers, high, true, probe), out);
+    }
+
+    void offsetsBetween(string_view low, string_view high, vector<uint64_t>& out) {
+        auto probe = [&](uint64_t entry) {
+            return textAt(entry);
+        };
+        append(bound(topTexts, low, false, probe), bound(topTexts, high, true, probe), out);
+    }
+
+    // Text of the row starting at an offset, without its line ending
+    string_view rowAt(uint64_t offset) {
+        rows->seek(offset);
+        return rows->nextRow() ? rows->rowText() : string_view();
+    }
+
+private:
+    uint64_t offsetOf(uint64_t entry) const {
+        uint64_t offset;
+        memcpy(&offset, offsets + entry * 8, 8);
+        return offset;
+    }
+
+    // Key of the row an entry points to
+    string_view textAt(uint64_t entry) {
+        rows->seek(offsetOf(entry));
+        if (!rows->nextRow() || position >= rows->fields().size()) {
+            return string_view();
+        }
+        string_view field = rows->fields()[position];
+        if (!rows->isQuoted(position) || field.find('"') == string_view::npos) {
+            return field;
+        }
+        unquoted = CsvReader::unquote(field);
+        return unquoted;
+    }
+
+    double numberAt(uint64_t entry) {
+        rows->seek(offsetOf(entry));
+        return rows->nextRow() && position < rows->fields().size()
+                   ? CsvReader::parseNumber(rows->fields()[position])
+                   : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    // First entry whose key is not below key (after false) or is above it (after true): the
+    // top level narrows the search down to one stride, which is then searched row by row
+    template <typename Top, typename Key, typename Probe>
+    uint64_t bound(const vector<Top>& top, Key key, bool after, Probe probe) {
+        auto before = [&](const auto& entryKey) {
+            return after ? !(key < entryKey) : entryKey < key;
+        };
+        size_t t = std::partition_point(top.begin(), top.end(), before) - top.begin();
+        uint64_t low = t ? (uint64_t)(t - 1) * stride + 1 : 0;
+        uint64_t high = std::min<uint64_t>(count, (uint64_t)t * stride);
+        while (low < high) {
+            uint64_t middle = low + (high - low) / 2;
+            if (before(probe(middle))) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    void append(uint64_t first, uint64_t last, vector<uint64_t>& out) const {
+        for (uint64_t entry = first; entry < last; ++entry) {
+            out.push_back(offsetOf(entry));
+        }
+    }
+
+    bool load(const string& path, const string& fingerprint, const string& column, size_t columnPosition) {
+        unique_ptr<MappedFile> mapped(new MappedFile(path, false));
+        const char* p = mapped->data();
+        const char* end = p + mapped->size();
+        auto take = [&](void* target, size_t size) {
+            if ((size_t)(end - p) < size) {
+                return false;
+            }
+            memcpy(target, p, size);
+            p += size;
+            return true;
+        };
+        auto takeText = [&](string& text) {
+            uint32_t size;
+            if (!take(&size, 4) || (size_t)(end - p) < size) {
+                return false;
+            }
+            text.assign(p, size);
+            p += size;
+            return true;
+        };
+
+        char magic[8];
+        string storedFingerprint, storedColumn;
+        uint32_t storedPosition;
+        if (!mapped->isOpen() || !take(magic, 8) || memcmp(magic, "FLOWIDX1", 8) != 0 ||
+            !takeText(storedFingerprint) || storedFingerprint != fingerprint || !takeText(storedColumn) ||
+            storedColumn != column || !take(&storedPosition, 4) || storedPosition != columnPosition ||
+            !take(&numeric, 1) || !take(&count, 8) || !take(&stride, 4) || stride == 0 ||
+            count > (size_t)(end - p) / 8) {
+            return false;
+        }
+        offsets = p;
+        p += count * 8;
+
+        topNumbers.clear();
+        topTexts.clear();
+        for (uint64_t entry = 0; entry < count; entry += stride) {
+            if (numeric) {
+                double key;
+                if (!take(&key, 8)) {
+                    return false;
+                }
+                topNumbers.push_back(key);
+            } else {
+                topTexts.emplace_back();
+                if (!takeText(topTexts.back())) {
+                    return false;
+                }
+            }
+        }
+
+        file = std::move(mapped);
+        return true;
+    }
+
+    // Index one column of csvPath into a file that atomically replaces path
+    static bool write(const string& csvPath, const string& path, const string& fingerprint, const string& column,
+                      size_t columnPosition) {
+        // The sidecar knows the column's type, and for numbers has every key already parsed
+        vector<double> numbers;
+        bool isNumber = true;
+        bool known = false;
+        if (auto store = ColumnStore::forCsv(csvPath, false)) {
+            if (columnPosition < store->getHeader().size() && store->getHeader()[columnPosition] == column) {
+                isNumber = store->type(columnPosition) == ColumnStore::NUMBER;
+                if (isNumber) {
+                    store->readNumbers(columnPosition, numbers);
+                }
+                known = true;
+            }
+        }
+
+        CsvReader reader(csvPath);
+        if (!reader.isOpen() || !reader.nextRow()) {
+            return false;
+        }
+        if (!known) {
+            while (isNumber && reader.nextRow()) {
+                const vector<string_view>& row = reader.fields();
+                isNumber = columnPosition >= row.size() || row[columnPosition].empty() ||
+                           !std::isnan(CsvReader::parseNumber(row[columnPosition]));
+            }
+            reader.seek(0);
+            reader.nextRow();
+        }
+
+        // Keys are views into the mapped CSV, except quoted ones with quotes inside
+        vector<pair<double, uint64_t>> numberKeys;
+        vector<pair<string_view, uint64_t>> textKeys;
+        std::deque<string> unquotedKeys;
+        for (uint64_t row = 0; reader.nextRow(); ++row) {
+            const vector<string_view>& fields = reader.fields();
+            string_view field = columnPosition < fields.size() ? fields[columnPosition] : string_view();
+            if (isNumber) {
+                double key = known ? (row < numbers.size() ? numbers[row] : std::numeric_limits<double>::quiet_NaN())
+                                   : CsvReader::parseNumber(field);
+                if (!std::isnan(key)) {
+                    numberKeys.emplace_back(key, reader.rowOffset());
+                }
+                continue;
+            }
+            if (columnPosition < fields.size() && reader.isQuoted(columnPosition) &&
+                field.find('"') != string_view::npos) {
+                unquotedKeys.push_back(CsvReader::unquote(field));
+                field = unquotedKeys.back();
+            }
+            textKeys.emplace_back(field, reader.rowOffset());
+        }
+        numbers = vector<double>();
+        std::sort(numberKeys.begin(), numberKeys.end());
+        std::sort(textKeys.begin(), textKeys.end());
+
+        uint64_t rowCount = isNumber ? numberKeys.size() : textKeys.size();
+        uint32_t positionField = columnPosition, stride = STRIDE;
+        uint8_t numericField = isNumber;
+        string data("FLOWIDX1", 8);
+        appendString(data, fingerprint);
+        appendString(data, column);
+        appendBytes(data, &positionField, 4);
+        appendBytes(data, &numericField, 1);
+        appendBytes(data, &rowCount, 8);
+        appendBytes(data, &stride, 4);
+        data.reserve(data.size() + rowCount * 8 + (rowCount / stride + 1) * 16);
+        for (uint64_t entry = 0; entry < rowCount; ++entry) {
+            appendBytes(data, isNumber ? &numberKeys[entry].second : &textKeys[entry].second, 8);
+        }
+        for (uint64_t entry = 0; entry < rowCount; entry += stride) {
+            if (isNumber) {
+                appendBytes(data, &numberKeys[entry].first, 8);
+            } else {
+                uint32_t size = textKeys[entry].first.size();
+                appendBytes(data, &size, 4);
+                appendBytes(data, textKeys[entry].first.data(), size);
+            }
+        }
+
+        string temporary = path + ".tmp." + to_string(getpid()) + "." + to_string(syscall(SYS_gettid));
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0;
+        for (size_t done = 0; ok && done < data.size();) {
+            ssize_t written = ::write(fd, data.data() + done, data.size() - done);
+            ok = written > 0;
+            done += ok ? written : 0;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        ok = ok && rename(temporary.c_str(), path.c_str()) == 0;
+        if (!ok) {
+            unlink(temporary.c_str());
+        } else {
+            threadCounters.bytesWritten += data.size();
+        }
+        return ok;
+    }
+};
+
+// Grouping
+
+// Sum, count, min, max and mean of value columns for every distinct key, in one pass over
+// the rows. Groups live in an open-addressing table with linear probing whose slots hold
+// only a hash and a group number, so a probe stays within one small array; keys are packed
+// into one arena and the totals of all groups into one flat array. When the groups outgrow
+// the memory budget, their partial totals are spilled to partition files chosen by hash
+// and the table starts over empty. At the end every partition is merged back on its own,
+// so memory stays near the budget however many groups there are, as long as the groups of
+// one partition fit.
+class GroupAggregator {
+public:
+    struct Totals {
+        double sum, min, max;
+        uint64_t count;     // values that are numbers
+    };
+
+    static const size_t PARTITIONS = 16;
+
+private:
+    static const uint32_t EMPTY = UINT32_MAX;
+
+    struct Slot {
+        uint64_t hash;
+        uint32_t group;
+    };
+
+    size_t valueCount;
+    size_t budget;
+    string spillBase;
+    vector<Slot> slots;
+    vector<uint64_t> keyOffsets;    // one past the last group: end of the last key
+    string keys;
+    vector<uint64_t> rowCounts;
+    vector<Totals> totals;          // valueCount per group
+    vector<unique_ptr<OutputSink>> partitions;
+    size_t spills;
+    bool merging;
+
+public:
+    GroupAggregator(size_t values, size_t memoryBudget, const string& spillPath)
+        : valueCount(values), budget(memoryBudget), spillBase(spillPath), spills(0), merging(false) {
+        clear(1024);
+    }
+
+    ~GroupAggregator() {
+        for (size_t p = 0; p < partitions.size(); ++p) {
+            partitions[p].reset();
+            unlink(partitionName(p).c_str());
+        }
+    }
+
+    // Add one row; NaN values (fields that are not numbers) count for nothing
+    void add(string_view key, const double* values) {
+        size_t group = findOrAdd(key, std::hash<string_view>()(key));
+        Totals* groupTotals = totals.data() + group * valueCount;
+        ++rowCounts[group];
+        for (size_t v = 0; v < valueCount; ++v) {
+            double value = values[v];
+            if (std::isnan(value)) {
+                continue;
+            }
+            Totals& t = groupTotals[v];
+            t.min = t.count ? std::min(t.min, value) : value;
+            t.max = t.count ? std::max(t.max, value) : value;
+            t.sum += value;
+            ++t.count;
+        }
+    }
+
+    size_t spillCount() const {
+        return spills;
+    }
+
+    // Hand every group to emit(key, rows, totals) once all rows are in: in the order the
+    // groups first appeared, or partition by partition if anything was spilled
+    template <typename Emit>
+    bool finish(Emit emit) {
+        if (partitions.empty()) {
+            emitGroups(emit);
+            return true;
+        }
+
+        spill();
+        merging = true;
+        for (size_t p = 0; p < partitions.size(); ++p) {
+            partitions[p]->flush();
+            bool written = partitions[p]->isOpen();
+            partitions[p].reset();
+            if (!written) {
+                return false;
+            }
+
+            clear(1024);
+            MappedFile file(partitionName(p));
+            const char* at = file.data();
+            const char* end = at + file.size();
+            while (at < end) {
+                uint32_t keyLength;
+                uint64_t rows;
+                memcpy(&keyLength, at, 4);
+                string_view key(at + 4, keyLength);
+                at += 4 + keyLength;
+                memcpy(&rows, at, 8);
+                at += 8;
+
+                size_t group = findOrAdd(key, std::hash<string_view>()(key));
+                rowCounts[group] += rows;
+                for (size_t v = 0; v < valueCount; ++v, at += sizeof(Totals)) {
+                    Totals partial;
+                    memcpy(&partial, at, sizeof(Totals));
+                    merge(totals[group * valueCount + v], partial);
+                }
+            }
+            emitGroups(emit);
+        }
+        return true;
+    }
+
+private:
+    string partitionName(size_t p) const {
+        return spillBase + ".spill" + to_string(p);
+    }
+
+    size_t groupCount() const {
+        return rowCounts.size();
+    }
+
+    string_view keyOf(size_t group) const {
+        return string_view(keys.data() + keyOffsets[group], keyOffsets[group + 1] - keyOffsets[group]);
+    }
+
+    // Memory the groups take; emptied arrays keep their capacity for the next round
+    size_t memoryUsed() const {
+        return slots.size() * sizeof(Slot) + keys.size() + groupCount() * (16 + valueCount * sizeof(Totals));
+    }
+
+    void clear(size_t slotCount) {
+        slots.assign(slotCount, Slot{0, EMPTY});
+        keyOffsets.assign(1, 0);
+        keys.clear();
+        rowCounts.clear();
+        totals.clear();
+    }
+
+    static void merge(Totals& into, const Totals& from) {
+        if (!from.count) {
+            return;
+        }
+        into.min = into.count ? std::min(into.min, from.min) : from.min;
+        into.max = into.count ? std::max(into.max, from.max) : from.max;
+        into.sum += from.sum;
+        into.count += from.count;
+    }
+
+    // Group number of a key, adding the group if it is new
+    size_t findOrAdd(string_view key, uint64_t hash) {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (slot.group == EMPTY) {
+                break;
+            }
+            if (slot.hash == hash && keyOf(slot.group) == key) {
+                return slot.group;
+            }
+        }
+
+        // A new group; make room first if it would go over the budget
+        size_t growth = key.size() + 16 + valueCount * sizeof(Totals);
+        if (!merging && groupCount() > 0 && memoryUsed() + growth > budget) {
+            spill();
+        }
+        if ((groupCount() + 1) * 2 > slots.size()) {
+            rehash(slots.size() * 2);
+        }
+
+        uint32_t group = groupCount();
+        keys.append(key);
+        keyOffsets.push_back(keys.size());
+        rowCounts.push_back(0);
+        totals.resize(totals.size() + valueCount, Totals{0, 0, 0, 0});
+
+        mask = slots.size() - 1;
+        size_t i = hash & mask;
+        while (slots[i].group != EMPTY) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = {hash, group};
+        return group;
+    }
+
+    void rehash(size_t slotCount) {
+        vector<Slot> old(slotCount, Slot{0, EMPTY});
+        old.swap(slots);
+        size_t mask = slotCount - 1;
+        for (const Slot& slot : old) {
+            if (slot.group == EMPTY) {
+                continue;
+            }
+            size_t i = slot.hash & mask;
+            while (slots[i].group != EMPTY) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+    }
+
+    // Write the partial totals of every group to its partition and empty the table
+    void spill() {
+        if (partitions.empty()) {
+            for (size_t p = 0; p < PARTITIONS; ++p) {
+                partitions.emplace_back(new OutputSink(partitionName(p), false, 64 << 10));
+            }
+        }
+
+        for (size_t group = 0; group < groupCount(); ++group) {
+            string_view key = keyOf(group);
+            uint32_t keyLength = key.size();
+            // The top bits pick the partition, the table probes with the bottom ones
+            OutputSink& out = *partitions[(std::hash<string_view>()(key) >> 60) % PARTITIONS];
+            out.write(reinterpret_cast<const char*>(&keyLength), 4);
+            out.write(key.data(), key.size());
+            out.write(reinterpret_cast<const char*>(&rowCounts[group]), 8);
+            out.write(reinterpret_cast<const char*>(&totals[group * valueCount]), valueCount * sizeof(Totals));
+        }
+        ++spills;
+        clear(1024);
+    }
+
+    template <typename Emit>
+    void emitGroups(Emit& emit) {
+        for (size_t group = 0; group < groupCount(); ++group) {
+            emit(keyOf(group), rowCounts[group], totals.data() + group * valueCount);
+        }
+    }
+};
+
+// Column arithmetic
+//
+// Element-wise a <op> b over whole columns. Either operand may instead be a single value
+// applied to every element. Results follow IEEE double arithmetic, except that division by
+// zero and NaN operands give NaN, which callers count as per-element errors. The kernels
+// use AVX2 when the CPU has it, SSE2 on any other x86-64 CPU and plain C++ elsewhere.
+enum ColumnOperation { COLUMN_ADD, COLUMN_SUB, COLUMN_MUL, COLUMN_DIV, COLUMN_MIN, COLUMN_MAX };
+
+template <ColumnOperation op>
+inline double columnValue(double a, double b) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    switch (op) {
+        case COLUMN_ADD: return a + b;
+        case COLUMN_SUB: return a - b;
+        case COLUMN_MUL: return a * b;
+        case COLUMN_DIV: return b == 0 ? nan : a / b;
+        case COLUMN_MIN: return std::isnan(a) || std::isnan(b) ? nan : std::min(a, b);
+        case COLUMN_MAX: return std::isnan(a) || std::isnan(b) ? nan : std::max(a, b);
+    }
+    return nan;
+}
+
+template <ColumnOperation op>
+void columnKernelScalar(const double* a, bool aSingle, const double* b, bool bSingle, double* out,
+                        size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        out[i] = columnValue<op>(aSingle ? a[0] : a[i], bSingle ? b[0] : b[i]);
+    }
+}
+
+#if defined(__x86_64__)
+template <ColumnOperation op>
+__attribute__((target("avx2"))) size_t columnKernelAvx2(const double* a, bool aSingle, const double* b,
+                                                          bool bSingle, double* out, size_t n) {
+    const __m256d nan = _mm256_set1_pd(std::numeric_limits<double>::quiet_NaN());
+    const __m256d zero = _mm256_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = aSingle ? _mm256_set1_pd(a[0]) : _mm256_loadu_pd(a + i);
+        __m256d y = bSingle ? _mm256_set1_pd(b[0]) : _mm256_loadu_pd(b + i);
+        __m256d r;
+        switch (op) {
+            case COLUMN_ADD: r = _mm256_add_pd(x, y); break;
+            case COLUMN_SUB: r = _mm256_sub_pd(x, y); break;
+            case COLUMN_MUL: r = _mm256_mul_pd(x, y); break;
+            case COLUMN_DIV: r = _mm256_blendv_pd(_mm256_div_pd(x, y), nan, _mm256_cmp_pd(y, zero, _CMP_EQ_OQ)); break;
+            case COLUMN_MIN: r = _mm256_blendv_pd(_mm256_min_pd(x, y), nan, _mm256_cmp_pd(x, y, _CMP_UNORD_Q)); break;
+            case COLUMN_MAX: r = _mm256_blendv_pd(_mm256_max_pd(x, y), nan, _mm256_cmp_pd(x, y, _CMP_UNORD_Q)); break;
+        }
+        _mm256_storeu_pd(out + i, r);
+    }
+    return i;
+}
+
+template <ColumnOperation op>
+size_t columnKernelSse2(const double* a, bool aSingle, const double* b, bool bSingle, double* out, size_t n) {
+    const __m128d nan = _mm_set1_pd(std::numeric_limits<double>::quiet_NaN());
+    const __m128d zero = _mm_setzero_pd();
+    size_t i = 0;
+
+    // SSE2 has no blend, so masked lanes are combined with and/andnot/or
+    auto select = [](__m128d mask, __m128d yes, __m128d no) {
+        return _mm_or_pd(_mm_and_pd(mask, yes), _mm_andnot_pd(mask, no));
+    };
+
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = aSingle ? _mm_set1_pd(a[0]) : _mm_loadu_pd(a + i);
+        __m128d y = bSingle ? _mm_set1_pd(b[0]) : _mm_loadu_pd(b + i);
+        __m128d r;
+        switch (op) {
+            case COLUMN_ADD: r = _mm_add_pd(x, y); break;
+            case COLUMN_SUB: r = _mm_sub_pd(x, y); break;
+            case COLUMN_MUL: r = _mm_mul_pd(x, y); break;
+            case COLUMN_DIV: r = select(_mm_cmpeq_pd(y, zero), nan, _mm_div_pd(x, y)); break;
+            case COLUMN_MIN: r = select(_mm_cmpunord_pd(x, y), nan, _mm_min_pd(x, y)); break;
+            case COLUMN_MAX: r = select(_mm_cmpunord_pd(x, y), nan, _mm_max_pd(x, y)); break;
+        }
+        _mm_storeu_pd(out + i, r);
+    }
+    return i;
+}
+#endif
+
+template <ColumnOperation op>
+void columnKernel(const double* a, bool aSingle, const double* b, bool bSingle, double* out, size_t n) {
+    size_t done = 0;
+#if defined(__x86_64__)
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    done = hasAvx2 ? columnKernelAvx2<op>(a, aSingle, b, bSingle, out, n)
+                   : columnKernelSse2<op>(a, aSingle, b, bSingle, out, n);
+#endif
+    columnKernelScalar<op>(a, aSingle, b, bSingle, out, done, n);
+}
+
+// Run one operation over n elements
+void columnOperation(ColumnOperation op, const double* a, bool aSingle, const double* b, bool bSingle,
+                     double* out, size_t n) {
+    switch (op) {
+        case COLUMN_ADD: columnKernel<COLUMN_ADD>(a, aSingle, b, bSingle, out, n); break;
+        case COLUMN_SUB: columnKernel<COLUMN_SUB>(a, aSingle, b, bSingle, out, n); break;
+        case COLUMN_MUL: columnKernel<COLUMN_MUL>(a, aSingle, b, bSingle, out, n); break;
+        case COLUMN_DIV: columnKernel<COLUMN_DIV>(a, aSingle, b, bSingle, out, n); break;
+        case COLUMN_MIN: columnKernel<COLUMN_MIN>(a, aSingle, b, bSingle, out, n); break;
+        case COLUMN_MAX: columnKernel<COLUMN_MAX>(a, aSingle, b, bSingle, out, n); break;
+    }
+}
+
+// Number of errors (NaN) among n results
+size_t columnErrors(const double* values, size_t n) {
+    size_t errors = 0;
+    for (size_t i = 0; i < n; ++i) {
+        errors += std::isnan(values[i]);
+    }
+    return errors;
+}
+
+// Run one operation over n elements and return how many of them are errors
+size_t applyColumnOperation(ColumnOperation op, const double* a, bool aSingle, const double* b, bool bSingle,
+                            double* out, size_t n) {
+    columnOperation(op, a, aSingle, b, bSingle, out, n);
+    return columnErrors(out, n);
+}
+
+// One element of an operation, for code that works a value at a time
+inline double scalarOperation(ColumnOperation op, double a, double b) {
+    switch (op) {
+        case COLUMN_ADD: return columnValue<COLUMN_ADD>(a, b);
+        case COLUMN_SUB: return columnValue<COLUMN_SUB>(a, b);
+        case COLUMN_MUL: return columnValue<COLUMN_MUL>(a, b);
+        case COLUMN_DIV: return columnValue<COLUMN_DIV>(a, b);
+        case COLUMN_MIN: return columnValue<COLUMN_MIN>(a, b);
+        case COLUMN_MAX: return columnValue<COLUMN_MAX>(a, b);
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+// Map the operation characters of CalculusStep ('m' is min, 'M' is max)
+bool columnOperationFor(char operation, ColumnOperation& op) {
+    switch (operation) {
+        case '+': op = COLUMN_ADD; return true;
+        case '-': op = COLUMN_SUB; return true;
+        case '*': op = COLUMN_MUL; return true;
+        case '/': op = COLUMN_DIV; return true;
+        case 'm': op = COLUMN_MIN; return true;
+        case 'M': op = COLUMN_MAX; return true;
+    }
+    return false;
+}
+
+// Value a step produces for the steps after it
+struct StepValue {
+    enum Kind { NONE, NUMBER, TEXT, COLUMN, TABLE, STREAM };
+
+    Kind kind = NONE;
+    double number = 0;
+    string text;
+    shared_ptr<const vector<double>> column; // COLUMN: one value per row
+    shared_ptr<CsvTable> table;              // TABLE: CSV file whose columns can be read
+    shared_ptr<ChunkChannel> channel;        // STREAM: CSV text, read once by one later step
+
+    bool operator==(const StepValue& other) const {
+        return kind == other.kind && number == other.number && text == other.text && column == other.column &&
+               table == other.table && channel == other.channel;
+    }
+};
+
+// Typed reference to the output of an earlier step in the same flow; for a TABLE, the
+// column to read from it
+struct StepInput {
+    size_t step;
+    StepValue::Kind kind;
+    string column;
+};
+
+// Expressions
+//
+// Arithmetic formulas over step outputs, such as "max(s2, s3) * (s4 - 1) / s5", where sN is
+// the output of the step at position N and sN.name a column of a CSV step. A formula is
+// parsed once: constant subexpressions are folded and what is left is flattened into
+// three-address instructions over one register file. The registers hold the referenced
+// values first, then the constants, then one temporary per instruction, so evaluating is
+// a single loop over the instructions with no tree walk and no allocation.
+class Expression {
+public:
+    struct Reference {
+        size_t step;
+        string column;
+    };
+
+    struct Instruction {
+        ColumnOperation op;
+        unsigned target, left, right;
+    };
+
+private:
+    struct Node {
+        enum Type { CONSTANT, REFERENCE, OPERATION };
+
+        Type type;
+        double value;
+        size_t reference;
+        ColumnOperation op;
+        unique_ptr<Node> left, right;
+        unsigned depth = 0;
+    };
+
+    // Register of a node while compiling, numbered within its own group
+    struct Slot {
+        enum Group { REFERENCE, CONSTANT, TEMPORARY };
+
+        Group group;
+        unsigned index;
+    };
+
+    // Instruction whose registers are still numbered within their groups
+    struct PendingInstruction {
+        ColumnOperation op;
+        Slot target, left, right;
+    };
+
+    vector<Reference> references;
+    vector<double> constants;
+    vector<Instruction> code;
+    unsigned resultRegister;
+    string errorMessage;
+
+    // Parser state
+    string_view text;
+    size_t position;
+    unsigned nesting;
+
+    // Parsing, emitting and freeing the tree all recurse, so both the parentheses and unary
+    // minus nesting and the height of the tree (a long chain of sums is as tall as it is long)
+    // are capped to keep an adversarial formula from overflowing the stack
+    static constexpr unsigned MAX_NESTING = 256;
+    static constexpr unsigned MAX_DEPTH = 4096;
+
+public:
+    Expression() : resultRegister(0), position(0), nesting(0) {}
+
+    bool compile(const string& formula) {
+        references.clear();
+        constants.clear();
+        code.clear();
+        errorMessage.clear();
+        text = formula;
+        position = 0;
+        nesting = 0;
+
+        unique_ptr<Node> root = parseSum();
+        skipSpaces();
+        if (errorMessage.empty() && position < text.size()) {
+            fail(string("unexpected '") + text[position] + "'");
+        }
+        text = string_view();
+
+        if (!errorMessage.empty()) {
+            references.clear();
+            return false;
+        }
+
+        vector<PendingInstruction> pending;
+        Slot result = emit(*root, pending);
+
+        // Temporaries go after the references and the constants
+        auto registerOf = [this](const Slot& slot) {
+            unsigned base = slot.group == Slot::REFERENCE ? 0
+                            : slot.group == Slot::CONSTANT ? references.size()
+                                                           : references.size() + constants.size();
+            return base + slot.index;
+        };
+        for (const PendingInstruction& instruction : pending) {
+            code.push_back({instruction.op, registerOf(instruction.target), registerOf(instruction.left),
+                            registerOf(instruction.right)});
+        }
+        resultRegister = registerOf(result);
+        return true;
+    }
+
+    const string& error() const {
+        return errorMessage;
+    }
+
+    const vector<Reference>& getReferences() const {
+        return references;
+    }
+
+    const vector<Instruction>& getCode() const {
+        return code;
+    }
+
+    size_t registerCount() const {
+        return references.size() + constants.size() + code.size();
+    }
+
+    // Size a register file and load the constants into it; the caller then stores the
+    // referenced values in the first registers before every evaluate()
+    void prepareRegisters(vector<double>& registers) const {
+        registers.assign(registerCount(), 0);
+        std::copy(constants.begin(), constants.end(), registers.begin() + references.size());
+    }
+
+    double evaluate(double* registers) const {
+        for (const Instruction& instruction : code) {
+            double a = registers[instruction.left], b = registers[instruction.right];
+            switch (instruction.op) {
+                case COLUMN_ADD: registers[instruction.target] = a + b; break;
+                case COLUMN_SUB: registers[instruction.target] = a - b; break;
+                case COLUMN_MUL: registers[instruction.target] = a * b; break;
+                default: registers[instruction.target] = scalarOperation(instruction.op, a, b); break;
+            }
+        }
+        return registers[resultRegister];
+    }
+
+    // Evaluate over n rows. inputs[i] holds the values of reference i, or a single value for
+    // every row when single[i] is set. Rows go through in blocks small enough for all the
+    // temporaries to stay in cache, each instruction running the vectorized column kernels
+    // over a whole block. Returns the number of rows whose result is an error.
+    size_t evaluateColumns(const vector<const double*>& inputs, const vector<bool>& single, size_t n,
+                           double* out) const {
+        const size_t block = 1024;
+        size_t firstTemporary = references.size() + constants.size();
+        vector<double> temporaries(code.size() * block);
+
+        auto operand = [&](unsigned reg, size_t start, bool& isSingle) -> const double* {
+            if (reg < references.size()) {
+                isSingle = single[reg];
+                return isSingle ? inputs[reg] : inputs[reg] + start;
+            }
+            if (reg < firstTemporary) {
+                isSingle = true;
+                return &constants[reg - references.size()];
+            }
+            isSingle = false;
+            return &temporaries[(reg - firstTemporary) * block];
+        };
+
+        for (size_t start = 0; start < n; start += block) {
+            size_t length = std::min(block, n - start);
+
+            for (const Instruction& instruction : code) {
+                bool leftSingle, rightSingle;
+                const double* left = operand(instruction.left, start, leftSingle);
+                const double* right = operand(instruction.right, start, rightSingle);
+                columnOperation(instruction.op, left, leftSingle, right, rightSingle,
+                                &temporaries[(instruction.target - firstTemporary) * block], length);
+            }
+
+            bool resultSingle;
+            const double* result = operand(resultRegister, start, resultSingle);
+            for (size_t i = 0; i < length; ++i) {
+                out[start + i] = resultSingle ? result[0] : result[i];
+            }
+        }
+        return columnErrors(out, n);
+    }
+
+private:
+    void fail(const string& message) {
+        if (errorMessage.empty()) {
+            errorMessage = message + " at position " + to_string(position);
+        }
+    }
+
+    void skipSpaces() {
+        while (position < text.size() && isspace((unsigned char)text[position])) {
+            ++position;
+        }
+    }
+
+    bool accept(char c) {
+        skipSpaces();
+        if (position < text.size() && text[position] == c) {
+            ++position;
+            return true;
+        }
+        return false;
+    }
+
+    static unique_ptr<Node> constant(double value) {
+        unique_ptr<Node> node(new Node());
+        node->type = Node::CONSTANT;
+        node->value = value;
+        return node;
+    }
+
+    // Combine two nodes, folding the operation right away when both sides are constants
+    unique_ptr<Node> combine(ColumnOperation op, unique_ptr<Node> left, unique_ptr<Node> right) {
+        if (!left || !right) {
+            return nullptr;
+        }
+        if (left->type == Node::CONSTANT && right->type == Node::CONSTANT) {
+            return constant(scalarOperation(op, left->value, right->value));
+        }
+        unsigned depth = std::max(left->depth, right->depth) + 1;
+        if (depth > MAX_DEPTH) {
+            fail("formula too long");
+            return nullptr;
+        }
+        unique_ptr<Node> node(new Node());
+        node->type = Node::OPERATION;
+        node->op = op;
+        node->left = std::move(left);
+        node->right = std::move(right);
+        node->depth = depth;
+        return node;
+    }
+
+    // sum := product (('+' | '-') product)*
+    unique_ptr<Node> parseSum() {
+        unique_ptr<Node> node = parseProduct();
+        while (node) {
+            if (accept('+')) {
+                node = combine(COLUMN_ADD, std::move(node), parseProduct());
+            } else if (accept('-')) {
+                node = combine(COLUMN_SUB, std::move(node), parseProduct());
+            } else {
+                break;
+            }
+        }
+        return node;
+    }
+
+    // product := unary (('*' | '/') unary)*
+    unique_ptr<Node> parseProduct() {
+        unique_ptr<Node> node = parseUnary();
+        while (node) {
+            if (accept('*')) {
+                node = combine(COLUMN_MUL, std::move(node), parseUnary());
+            } else if (accept('/')) {
+                node = combine(COLUMN_DIV, std::move(node), parseUnary());
+            } else {
+                break;
+            }
+        }
+        return node;
+    }
+
+    // unary := '-' unary | primary
+    // Every nested parenthesis or argument list comes back through here, so this is where the
+    // nesting is counted.
+    unique_ptr<Node> parseUnary() {
+        if (nesting == MAX_NESTING) {
+            fail("formula nested too deeply");
+            return nullptr;
+        }
+        ++nesting;
+        unique_ptr<Node> node = accept('-') ? combine(COLUMN_SUB, constant(0), parseUnary()) : parsePrimary();
+        --nesting;
+        return node;
+    }
+
+    // primary := number | sN | sN.column | ('min' | 'max') '(' sum (',' sum)+ ')' | '(' sum ')'
+    unique_ptr<Node> parsePrimary() {
+        skipSpaces();
+        if (position >= text.size()) {
+            fail("unexpected end of formula");
+            return nullptr;
+        }
+
+        if (accept('(')) {
+            unique_ptr<Node> node = parseSum();
+            if (node && !accept(')')) {
+                fail("missing ')'");
+                return nullptr;
+            }
+            return node;
+        }
+
+        char c = text[position];
+        if (isdigit((unsigned char)c) || c == '.') {
+            double value;
+            auto parsed = std::from_chars(text.data() + position, text.data() + text.size(), value);
+            if (parsed.ec != std::errc()) {
+                fail("invalid number");
+                return nullptr;
+            }
+            position = parsed.ptr - text.data();
+            return constant(value);
+        }
+
+        string word;
+        while (position < text.size() && (isalnum((unsigned char)text[position]) || text[position] == '_')) {
+            word += text[position++];
+        }
+
+        if (word == "min" || word == "max") {
+            ColumnOperation op = word == "min" ? COLUMN_MIN : COLUMN_MAX;
+            if (!accept('(')) {
+                fail("expected '(' after " + word);
+                return nullptr;
+            }
+            unique_ptr<Node> node = parseSum();
+            int arguments = 1;
+            while (node && accept(',')) {
+                node = combine(op, std::move(node), parseSum());
+                ++arguments;
+            }
+            if (node && (arguments < 2 || !accept(')'))) {
+                fail(word + " takes two or more arguments in parentheses");
+                return nullptr;
+            }
+            return node;
+        }
+
+        if (word.size() > 1 && word[0] == 's' && all_of(word.begin() + 1, word.end(), ::isdigit)) {
+            Reference reference{0, ""};
+            auto parsed = std::from_chars(word.data() + 1, word.data() + word.size(), reference.step);
+            if (parsed.ec != std::errc()) {
+                fail("step number in " + word + " is too large");
+                return nullptr;
+            }
+            if (position < text.size() && text[position] == '.') {
+                ++position;
+                while (position < text.size() && (isalnum((unsigned char)text[position]) || text[position] == '_')) {
+                    reference.column += text[position++];
+                }
+                if (reference.column.empty()) {
+                    fail("missing column name after " + word + ".");
+                    return nullptr;
+                }
+            }
+
+            unique_ptr<Node> node(new Node());
+            node->type = Node::REFERENCE;
+            node->reference = addReference(reference);
+            return node;
+        }
+
+        fail(word.empty() ? string("unexpected '") + c + "'" : "unknown name '" + word + "'");
+        return nullptr;
+    }
+
+    size_t addReference(const Reference& reference) {
+        for (size_t i = 0; i < references.size(); ++i) {
+            if (references[i].step == reference.step && references[i].column == reference.column) {
+                return i;
+            }
+        }
+        references.push_back(reference);
+        return references.size() - 1;
+    }
+
+    Slot emit(const Node& node, vector<PendingInstruction>& pending) {
+        if (node.type == Node::CONSTANT) {
+            constants.push_back(node.value);
+            return {Slot::CONSTANT, (unsigned)constants.size() - 1};
+        }
+        if (node.type == Node::REFERENCE) {
+            return {Slot::REFERENCE, (unsigned)node.reference};
+        }
+
+        Slot left = emit(*node.left, pending);
+        Slot right = emit(*node.right, pending);
+        Slot target{Slot::TEMPORARY, (unsigned)pending.size()};
+
+        pending.push_back({node.op, target, left, right});
+        return target;
+    }
+};
+
+// Thread pool
+
+// Work-stealing thread pool. Every worker owns a deque: tasks a worker submits go to the
+// back of its own deque and it takes work from the back (most recent first, while the data
+// is still in cache); an idle worker steals from the front of the others' deques. Tasks
+// submitted from outside the pool are spread over the deques round-robin.
+class ThreadPool {
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<std::thread> threads;
+    std::mutex sleepLock;
+    std::condition_variable wakeUp;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> nextWorker;
+    bool stopping;
+
+    static thread_local int currentWorker;
+
+public:
+    ThreadPool(size_t size) : pending(0), nextWorker(0), stopping(false) {
+        size = std::max<size_t>(size, 1);
+        for (size_t i = 0; i < size; ++i) {
+            workers.emplace_back(new Worker());
+        }
+        for (size_t i = 0; i < size; ++i) {
+            threads.emplace_back(&ThreadPool::workerLoop, this, (int)i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Pool shared by every flow, one worker per core
+    static ThreadPool& shared() {
+        static ThreadPool pool(std::thread::hardware_concurrency());
+        return pool;
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    // Call body(i) for every i < count on the pool and return once all calls are done.
+    // The calling thread takes part, so this also works from inside a pool task when
+    // every worker is busy.
+    void forEach(size_t count, const function<void(size_t)>& body) {
+        struct Job {
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> done{0};
+            size_t count;
+            const function<void(size_t)>* body;
+            std::mutex lock;
+            std::condition_variable finished;
+        };
+        auto job = make_shared<Job>();
+        job->count = count;
+        job->body = &body;
+
+        // Helpers that start late find nothing left and only touch the shared job
+        auto work = [job] {
+            for (size_t i; (i = job->next++) < job->count;) {
+                (*job->body)(i);
+                if (++job->done == job->count) {
+                    std::lock_guard<std::mutex> guard(job->lock);
+                    job->finished.notify_all();
+                }
+            }
+        };
+        for (size_t helper = 1; helper < std::min(count, workers.size() + 1); ++helper) {
+            submit(work);
+        }
+        work();
+
+        std::unique_lock<std::mutex> guard(job->lock);
+        job->finished.wait(guard, [&] { return job->done == job->count; });
+    }
+
+    void submit(function<void()> task) {
+        size_t target = currentWorker >= 0 ? currentWorker : nextWorker++ % workers.size();
+
+        // Counted before it is published, so a worker taking it right away can never bring
+        // pending below zero
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            ++pending;
+        }
+        try {
+            std::lock_guard<std::mutex> guard(workers[target]->lock);
+            workers[target]->tasks.push_back(std::move(task));
+        } catch (...) {
+            --pending;
+            throw;
+        }
+        wakeUp.notify_one();
+    }
+
+private:
+    bool takeTask(size_t self, function<void()>& task) {
+        {
+            Worker& own = *workers[self];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < workers.size(); ++i) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int self) {
+        currentWorker = self;
+        function<void()> task;
+
+        while (true) {
+            if (takeTask(self, task)) {
+                --pending;
+                task();
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wakeUp.wait(guard, [this] { return stopping || pending > 0; });
+            if (stopping && pending == 0) {
+                return;
+            }
+        }
+    }
+};
+
+thread_local int ThreadPool::currentWorker = -1;
+
+// Text ingestion
+
+// Occurrences of tokens, counted in an open-addressing table of views into the text
+// itself, so counting copies no token
+class TokenCounts {
+private:
+    struct Entry {
+        uint64_t hash;
+        string_view token;
+        uint64_t count;     // 0 for an empty entry
+    };
+
+    vector<Entry> entries;
+    size_t used;
+
+public:
+    TokenCounts() : entries(256, Entry{0, {}, 0}), used(0) {}
+
+    void add(string_view token, uint64_t hash, uint64_t count = 1) {
+        size_t mask = entries.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Entry& entry = entries[i];
+            if (!entry.count) {
+                entry = {hash, token, count};
+                if (++used * 2 > entries.size()) {
+                    grow();
+                }
+                return;
+            }
+            if (entry.hash == hash && entry.token == token) {
+                entry.count += count;
+                return;
+            }
+        }
+    }
+
+    size_t size() const {
+        return used;
+    }
+
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (const Entry& entry : entries) {
+            if (entry.count) {
+                visit(entry.token, entry.hash, entry.count);
+            }
+        }
+    }
+
+private:
+    void grow() {
+        vector<Entry> old(entries.size() * 2, Entry{0, {}, 0});
+        old.swap(entries);
+        size_t mask = entries.size() - 1;
+        for (const Entry& entry : old) {
+            if (entry.count) {
+                size_t i = entry.hash & mask;
+                while (entries[i].count) {
+                    i = (i + 1) & mask;
+                }
+                entries[i] = entry;
+            }
+        }
+    }
+};
+
+struct TextStats {
+    uint64_t bytes = 0;
+    uint64_t lines = 0;
+    uint64_t emptyLines = 0;
+    uint64_t longestLine = 0;
+    uint64_t words = 0;         // runs of non-whitespace, as wc counts them
+    uint64_t tokens = 0;        // runs of letters, digits and underscores
+    uint64_t byteCounts[256] = {};
+
+    void merge(const TextStats& other) {
+        bytes += other.bytes;
+        lines += other.lines;
+        emptyLines += other.emptyLines;
+        longestLine = std::max(longestLine, other.longestLine);
+        words += other.words;
+        tokens += other.tokens;
+        for (int b = 0; b < 256; ++b) {
+            byteCounts[b] += other.byteCounts[b];
+        }
+    }
+
+    uint64_t countBytes(bool (*matches)(unsigned char)) const {
+        uint64_t total = 0;
+        for (int b = 0; b < 256; ++b) {
+            total += matches(b) ? byteCounts[b] : 0;
+        }
+        return total;
+    }
+};
+
+// Count lines, words, tokens and bytes of a whole file, and how often every token occurs.
+// The file is mapped and cut into chunks that end on a newline; the chunks are scanned on
+// the thread pool, each into its own statistics and token tables, which are partitioned by
+// hash so that every partition can then be merged by one thread without any locking.
+// Tokens are views into the mapping, valid while file is.
+class TextIngest {
+public:
+    static const size_t PARTITIONS = 16;
+
+    TextStats stats;
+    vector<pair<string_view, uint64_t>> tokens;     // most frequent first
+
+    void run(const MappedFile& file) {
+        ThreadPool& pool = ThreadPool::shared();
+        const char* data = file.data();
+        size_t size = file.size();
+
+        // A few chunks per worker evens out the load, but none under a megabyte
+        vector<pair<size_t, size_t>> chunks;
+        size_t target = std::max<size_t>(size / (pool.size() * 4 + 1), 1 << 20);
+        for (size_t begin = 0; begin < size;) {
+            size_t end = std::min(begin + target, size);
+            if (end < size) {
+                const char* newline = static_cast<const char*>(memchr(data + end, '\n', size - end));
+                end = newline ? newline - data + 1 : size;
+            }
+            chunks.push_back({begin, end});
+            begin = end;
+        }
+
+        struct Chunk {
+            TextStats stats;
+            TokenCounts partitions[PARTITIONS];
+        };
+        vector<Chunk> scanned(chunks.size());
+        pool.forEach(chunks.size(), [&](size_t c) {
+            scan(data + chunks[c].first, data + chunks[c].second, scanned[c].stats, scanned[c].partitions);
+        });
+
+        vector<TokenCounts> merged(PARTITIONS);
+        pool.forEach(PARTITIONS, [&](size_t p) {
+            for (Chunk& chunk : scanned) {
+                chunk.partitions[p].forEach([&](string_view token, uint64_t hash, uint64_t count) {
+                    merged[p].add(token, hash, count);
+                });
+            }
+        });
+
+        stats = TextStats();
+        for (Chunk& chunk : scanned) {
+            stats.merge(chunk.stats);
+        }
+        tokens.clear();
+        for (TokenCounts& partition : merged) {
+            partition.forEach([&](string_view token, uint64_t, uint64_t count) { tokens.push_back({token, count}); });
+        }
+        sort(tokens.begin(), tokens.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+    }
+
+private:
+    enum { SPACE = 1, TOKEN = 2 };
+
+    static const unsigned char* classes() {
+        static const auto table = [] {
+            std::array<unsigned char, 256> t = {};
+            for (int c = 0; c < 256; ++c) {
+                t[c] = (isspace(c) ? SPACE : 0) | (isalnum(c) || c == '_' || c >= 0x80 ? TOKEN : 0);
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    static void scan(const char* begin, const char* end, TextStats& stats, TokenCounts* partitions) {
+        const unsigned char* table = classes();
+        const char* lineStart = begin;
+        const char* tokenStart = nullptr;
+        bool inWord = false;
+
+        auto endToken = [&](const char* at) {
+            string_view token(tokenStart, at - tokenStart);
+            uint64_t hash = std::hash<string_view>()(token);
+            partitions[hash >> 60].add(token, hash);
+            ++stats.tokens;
+            tokenStart = nullptr;
+        };
+        auto endLine = [&](const char* at) {
+            size_t length = at - lineStart;
+            if (length && at[-1] == '\r') {
+                --length;
+            }
+            stats.longestLine = std::max<uint64_t>(stats.longestLine, length);
+            stats.emptyLines += length == 0;
+            ++stats.lines;
+        };
+
+        for (const char* p = begin; p < end; ++p) {
+            unsigned char c = *p;
+            unsigned char kind = table[c];
+            ++stats.byteCounts[c];
+
+            if (kind & TOKEN) {
+                tokenStart = tokenStart ? tokenStart : p;
+            } else if (tokenStart) {
+                endToken(p);
+            }
+
+            if (kind & SPACE) {
+                inWord = false;
+            } else if (!inWord) {
+                inWord = true;
+                ++stats.words;
+            }
+
+            if (c == '\n') {
+                endLine(p);
+                lineStart = p + 1;
+            }
+        }
+        if (tokenStart) {
+            endToken(end);
+        }
+        if (lineStart < end) {
+            endLine(end);
+        }
+        stats.bytes += end - begin;
+    }
+};
+
+// Report templates
+
+// Text with placeholders, parsed once into literal and placeholder segments:
+//
+//   {{sN}}        the output of step N: a number, a text, or the row count of a table
+//   {{sN.name}}   column name of the current record of the CSV (table) step N
+//   {{row}}       number of the current record, from 1
+//
+// Placeholder values are passed to render() as one string_view per reference, in the
+// order of the reference list the template was parsed against; rendering measures the
+// result first and then fills it in with plain copies, so it allocates at most once.
+class ReportTemplate {
+public:
+    struct Reference {
+        size_t step;
+        string column;      // empty for the step's own value
+    };
+
+private:
+    enum SegmentKind { LITERAL, VALUE, ROW };
+
+    struct Segment {
+        SegmentKind kind;
+        size_t begin, length;   // LITERAL: range of the source text
+        size_t reference;       // VALUE: index in the reference list
+    };
+
+    string source;
+    vector<Segment> segments;
+    string parseError;
+    bool perRecord;
+
+public:
+    ReportTemplate() : perRecord(false) {}
+
+    // Parse text, adding the steps it refers to to references (shared by the templates of
+    // one step, so that every reference is resolved once)
+    bool parse(const string& text, vector<Reference>& references) {
+        source = text;
+        segments.clear();
+        parseError.clear();
+        perRecord = false;
+
+        size_t at = 0;
+        while (at < source.size()) {
+            size_t open = source.find("{{", at);
+            if (open == string::npos) {
+                open = source.size();
+            }
+            if (open > at) {
+                segments.push_back({LITERAL, at, open - at, 0});
+            }
+            if (open == source.size()) {
+                break;
+            }
+
+            size_t close = source.find("}}", open + 2);
+            if (close == string::npos) {
+                parseError = "unterminated placeholder at position " + to_string(open);
+                return false;
+            }
+            string name = source.substr(open + 2, close - open - 2);
+            at = close + 2;
+
+            if (name == "row") {
+                segments.push_back({ROW, 0, 0, 0});
+                perRecord = true;
+                continue;
+            }
+
+            size_t dot = name.find('.');
+            string step = name.substr(0, dot);
+            if (step.size() < 2 || step[0] != 's' || step.find_first_not_of("0123456789", 1) != string::npos) {
+                parseError = "unknown placeholder '{{" + name + "}}'";
+                return false;
+            }
+            Reference reference{0, dot == string::npos ? "" : name.substr(dot + 1)};
+            auto parsed = std::from_chars(step.data() + 1, step.data() + step.size(), reference.step);
+            if (parsed.ec != std::errc()) {
+                parseError = "step number in '{{" + name + "}}' is too large";
+                return false;
+            }
+            perRecord = perRecord || !reference.column.empty();
+
+            size_t index = 0;
+            while (index < references.size() &&
+                   (references[index].step != reference.step || references[index].column != reference.column)) {
+                ++index;
+            }
+            if (index == references.size()) {
+                references.push_back(reference);
+            }
+            segments.push_back({VALUE, 0, 0, index});
+        }
+        return true;
+    }
+
+    const string& error() const {
+        return parseError;
+    }
+
+    // Whether the text changes from record to record
+    bool isPerRecord() const {
+        return perRecord;
+    }
+
+    // Length of the text rendered with these values
+    size_t measure(const string_view* values, size_t row) const {
+        size_t size = 0;
+        for (const Segment& segment : segments) {
+            size += segment.kind == LITERAL ? segment.length
+                  : segment.kind == VALUE   ? values[segment.reference].size()
+                                            : digits(row);
+        }
+        return size;
+    }
+
+    // Write the rendered text at out, which has room for measure() characters; returns
+    // the end of what was written
+    char* fill(const string_view* values, size_t row, char* out) const {
+        for (const Segment& segment : segments) {
+            if (segment.kind == LITERAL) {
+                memcpy(out, source.data() + segment.begin, segment.length);
+                out += segment.length;
+            } else if (segment.kind == VALUE) {
+                memcpy(out, values[segment.reference].data(), values[segment.reference].size());
+                out += values[segment.reference].size();
+            } else {
+                out = std::to_chars(out, out + 20, row).ptr;
+            }
+        }
+        return out;
+    }
+
+    // Append the rendered text to out, growing it once
+    void render(const string_view* values, size_t row, string& out) const {
+        size_t at = out.size();
+        out.resize(at + measure(values, row));
+        fill(values, row, &out[at]);
+    }
+
+private:
+    static size_t digits(size_t value) {
+        size_t count = 1;
+        while (value >= 10) {
+            value /= 10;
+            ++count;
+        }
+        return count;
+    }
+};
+
+// Input providers
+//
+// Where text input steps get their answers: the terminal (the default), a replay file
+// loaded into memory up front, or a generator that makes answers up from a seed. Whatever
+// the source, answers can also be recorded to a file that replays them later. A replay
+// file holds one answer per line and is used in order; it starts over when it runs out,
+// so a short recording can drive a long load test. Only the terminal counts as
+// interactive, so flows fed from a file or a generator run like any other.
+class InputProvider {
+public:
+    enum Source { TERMINAL, REPLAY, GENERATED };
+
+private:
+    Source source;
+    string replayText;
+    vector<string_view> answers;
+    std::atomic<uint64_t> nextAnswer;
+    uint64_t seed;
+    int recordFd;
+
+public:
+    InputProvider() : source(TERMINAL), nextAnswer(0), seed(0), recordFd(-1) {}
+
+    ~InputProvider() {
+        if (recordFd >= 0) {
+            close(recordFd);
+        }
+    }
+
+    static InputProvider& global() {
+        static InputProvider provider;
+        return provider;
+    }
+
+    bool replayFrom(const string& path) {
+        MappedFile file(path);
+        if (!file.isOpen()) {
+            std::cerr << "Unable to open replay file '" << path << "'.\n";
+            return false;
+        }
+
+        replayText.assign(file.data(), file.size());
+        answers.clear();
+        string_view rest = replayText;
+        while (!rest.empty()) {
+            size_t newline = rest.find('\n');
+            string_view line = rest.substr(0, newline);
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            answers.push_back(line);
+            rest.remove_prefix(newline == string_view::npos ? rest.size() : newline + 1);
+        }
+        if (answers.empty()) {
+            std::cerr << "Replay file '" << path << "' has no answers.\n";
+            return false;
+        }
+        source = REPLAY;
+        nextAnswer = 0;
+        return true;
+    }
+
+    void generateFrom(uint64_t generatorSeed) {
+        source = GENERATED;
+        seed = generatorSeed;
+        nextAnswer = 0;
+    }
+
+    // Append every answer to path, one per line, whichever process or thread asks
+    bool recordTo(const string& path) {
+        recordFd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (recordFd < 0) {
+            std::cerr << "Unable to open record file '" << path << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool isInteractive() const {
+        return source == TERMINAL;
+    }
+
+    // The answer to a prompt; false when there is none (the terminal was closed)
+    bool next(string& answer) {
+        if (source == TERMINAL) {
+            if (!(cin >> answer)) {
+                return false;
+            }
+        } else {
+            uint64_t index = nextAnswer.fetch_add(1, std::memory_order_relaxed);
+            if (source == REPLAY) {
+                answer.assign(answers[index % answers.size()]);
+            } else {
+                answer = generated(index);
+            }
+        }
+
+        if (recordFd >= 0) {
+            string line = answer + "\n";
+            if (write(recordFd, line.data(), line.size()) == (ssize_t)line.size()) {
+                threadCounters.bytesWritten += line.size();
+            }
+        }
+        return true;
+    }
+
+private:
+    // Word of 3 to 10 lowercase letters and digits, the same for the same seed and index
+    string generated(uint64_t index) const {
+        uint64_t z = seed + (index + 1) * 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        z ^= z >> 31;
+
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+        string word(3 + z % 8, ' ');
+        for (char& c : word) {
+            z = z * 6364136223846793005ull + 1442695040888963407ull;
+            c = alphabet[(z >> 33) % 36];
+        }
+        return word;
+    }
+};
+
+// Output names starting with '@' are streams rather than files
+bool isStreamName(const string& name) {
+    return !name.empty() && name[0] == '@';
+}
+
+// Stream steps print to. It is cout unless the parallel scheduler has pointed it at a
+// per-step buffer, which it then prints in flow order.
+thread_local ostream* stepConsole = &cout;
+
+ostream& console() {
+    return *stepConsole;
+}
+
+// Define steps
+//
+// Steps are plain values held in a closed variant (AnyStep), so a flow stores them
+// contiguously and calls them without a vtable. Every step provides execute() and
+// writeOutput(), plus kindName() and fields(): the keyword and text arguments that
+// addStepFromFields() rebuilds it from. Step supplies the defaults for the optional hooks
+// below, which a step replaces simply by declaring a member with the same name.
+class Step {
+protected:
+    StepValue output;
+
+    // A new stream to publish for the run about to start (see streamName())
+    void openStream(const string& name) {
+        output = StepValue();
+        output.kind = StepValue::STREAM;
+        output.text = name;
+        output.channel = make_shared<ChunkChannel>();
+    }
+
+public:
+    // Outputs of earlier steps this step reads, in the order setInputs() receives them
+    vector<StepInput> getInputs() const {
+        return {};
+    }
+
+    void setInputs(const vector<const StepValue*>& /*values*/) {}
+
+    // Kind of value the step publishes, known before it runs
+    StepValue::Kind outputKind() const {
+        return StepValue::NONE;
+    }
+
+    const StepValue& getOutput() const {
+        return output;
+    }
+
+    // Identity of everything outside the flow the result depends on (e.g. input files)
+    string inputFingerprint() const {
+        return "";
+    }
+
+    // Pure steps depend only on their inputs and fingerprint, so a flow may reuse their
+    // previous result and call replay() instead of execute(); every pure step defines it
+    bool isPure() const {
+        return false;
+    }
+
+    void replay() {}
+
+    // Files the step reads and writes; steps that share no files and no inputs may run
+    // at the same time
+    vector<string> filesRead() const {
+        return {};
+    }
+
+    vector<string> filesWritten() const {
+        return {};
+    }
+
+    // Steps talking to the user must run on their own
+    bool isInteractive() const {
+        return false;
+    }
+
+    // Streams (see ChunkChannel): a step whose output kind is STREAM creates its channel in
+    // setInputs() and writes CSV text into it from execute(), which the flow runs on a
+    // thread of its own alongside the one later step reading the stream. The name is what
+    // that step refers to it by (e.g. "display @sales").
+    string streamName() const {
+        return "";
+    }
+
+    // Row-batched runs over a dataset (see DatasetRun): a step computing a number from
+    // numbers computes it for n rows at once, where input i holds one value per row, or
+    // one value for all rows when single[i] is set. Returns false if the step cannot.
+    bool evaluateRows(const vector<const double*>&, const vector<bool>&, size_t, double*) const {
+        return false;
+    }
+
+    // On-disk result cache (see ResultCache): a pure step reading files but no other step
+    // may save its result as bytes once it has executed, and restore it instead of
+    // executing while the files are unchanged. loadResult() returns false for a saved
+    // result that can no longer be used, and the step then executes.
+    bool saveResult(string&) const {
+        return false;
+    }
+
+    bool loadResult(string_view) {
+        return false;
+    }
+};
+
+class TitleStep : public Step {
+private:
+    string title, subtitle;
+
+public:
+    TitleStep(const string& t, const string& st) : title(t), subtitle(st) {}
+
+    void execute() {
+        console() << "Title: " << title << "\nSubtitle: " << subtitle << endl;
+    }
+
+    const char* kindName() const {
+        return "title";
+    }
+
+    vector<string> fields() const {
+        return {title, subtitle};
+    }
+
+    void writeOutput(OutputSink& out) {
+        out << "Title: " << title << "\nSubtitle: " << subtitle << '\n';
+    }
+};
+
+class TextStep : public Step {
+private:
+    string title, copy;
+    
+public:
+    TextStep(const string& t, const string& c) : title(t), copy(c) {}
+    
+    void execute() {
+        console() << "Title: " << title << "\nCopy: " << copy << endl;
+    }
+
+    const char* kindName() const {
+        return "text";
+    }
+
+    vector<string> fields() const {
+        return {title, copy};
+    }
+
+    void writeOutput(OutputSink& out) {
+        try {
+            out << "Title: " << title << "\nCopy: " << copy << '\n';
+        } catch (const std::exception& e) {
+            std::cerr << "Error writing to the file: " << e.what() << std::endl;
+        }
+    }
+
+};
+
+class TextInputStep : public Step {
+private:
+    string description;
+
+public:
+    TextInputStep(const string& desc) : description(desc) {}
+
+    // The answer comes from the InputProvider and stays the step's output
+    void execute() {
+        InputProvider& input = InputProvider::global();
+        string answer;
+        if (input.isInteractive()) {
+            console() << description << ": ";
+        }
+        if (!input.next(answer)) {
+            std::cerr << "No input for '" << description << "'.\n";
+        } else if (!input.isInteractive()) {
+            console() << description << ": " << answer << endl;
+        }
+        output.kind = StepValue::TEXT;
+        output.text = answer;
+    }
+
+    StepValue::Kind outputKind() const {
+        return StepValue::TEXT;
+    }
+
+    bool isInteractive() const {
+        return InputProvider::global().isInteractive();
+    }
+
+    const char* kindName() const {
+        return "textinput";
+    }
+
+    vector<string> fields() const {
+        return {description};
+    }
+
+    void writeOutput(OutputSink& out) {
+        out << description << ": " << output.text << '\n';
+    }
+};
+
+class NumberInputStep : public Step {
+private:
+    string description;
+    int numberInput;
+
+public:
+    NumberInputStep(const string& desc, int num) : description(desc), numberInput(num) {
+        output.kind = StepValue::NUMBER;
+        output.number = num;
+    }
+
+    void execute() {
+        console() << description << ": " << numberInput << endl;
+    }
+
+    StepValue::Kind outputKind() const {
+        return StepValue::NUMBER;
+    }
+
+    bool isPure() const {
+        return true;
+    }
+
+    void replay() {
+        execute();
+    }
+
+    int getNumber() {
+        return numberInput;
+    }
+
+    const char* kindName() const {
+        return "number";
+    }
+
+    vector<string> fields() const {
+        return {description, to_string(numberInput)};
+    }
+
+    void writeOutput(OutputSink& out) {
+    try {
+        out << description << ": " << to_string(numberInput) << '\n';
+    } catch (const std::exception& e) {
+        std::cerr << "Error writing to the file: " << e.what() << std::endl;
+    }
+}
+    
+};
+
+class CalculusStep : public Step {
+private:
+    StepInput operands[2];
+    double numbersFromSteps[2];
+    shared_ptr<const vector<double>> columnsFromSteps[2];
+    char operation;
+    double result;
+    size_t errors;
+
+public:
+    // Operands are the positions of two earlier steps producing numbers; their values are
+    // read every time the flow runs
+    CalculusStep(size_t first, size_t second, const char op)
+        : CalculusStep(StepInput{first, StepValue::NUMBER, ""}, StepInput{second, StepValue::NUMBER, ""}, op) {}
+
+    // Operands may also be whole columns, either produced by an earlier calculation or read
+    // from a CSV input; the operation then applies element-wise, with a number operand used
+    // for every element
+    CalculusStep(const StepInput& first, const StepInput& second, const char op)
+        : operation(op), result(0), errors(0) {
+        operands[0] = first;
+        operands[1] = second;
+        numbersFromSteps[0] = numbersFromSteps[1] = 0;
+    }
+
+    vector<StepInput> getInputs() const {
+        return {operands[0], operands[1]};
+    }
+
+    void setInputs(const vector<const StepValue*>& values) {
+        for (int i = 0; i < 2; ++i) {
+            numbersFromSteps[i] = values[i]->number;
+            columnsFromSteps[i] = nullptr;
+            if (operands[i].kind == StepValue::COLUMN) {
+                columnsFromSteps[i] = values[i]->column;
+            } else if (operands[i].kind == StepValue::TABLE && values[i]->table) {
+                columnsFromSteps[i] = values[i]->table->column(operands[i].column);
+            }
+        }
+    }
+
+    StepValue::Kind outputKind() const {
+        return isColumnar() ? StepValue::COLUMN : StepValue::NUMBER;
+    }
+
+    bool isPure() const {
+        return true;
+    }
+
+    // Show the remembered result without recomputing it
+    void replay() {
+        if (isColumnar()) {
+            console() << "The result is: " << (output.column ? output.column->size() : 0) << " values, "
+                      << errors << " errors" << endl;
+        } else {
+            console() << "The result is: " << result << endl;
+        }
+    }
+
+    void execute() {
+        if (isColumnar()) {
+            executeColumns();
+            return;
+        }
+
+        console() << "The result is: ";
+
+        ColumnOperation op;
+        if (!columnOperationFor(operation, op)) {
+            console() << "Invalid operation!" << std::endl;
+        } else if (op == COLUMN_DIV && numbersFromSteps[1] == 0) {
+            console() << "Error: Division by zero!" << std::endl;
+            result = std::numeric_limits<double>::quiet_NaN();
+        } else {
+            applyColumnOperation(op, &numbersFromSteps[0], true, &numbersFromSteps[1], true, &result, 1);
+        }
+
+        console() << result << endl;
+        output.kind = StepValue::NUMBER;
+        output.number = result;
+    }
+
+    bool evaluateRows(const vector<const double*>& inputs, const vector<bool>& single, size_t n,
+                      double* out) const {
+        ColumnOperation op;
+        if (isColumnar() || !columnOperationFor(operation, op)) {
+            return false;
+        }
+        columnOperation(op, inputs[0], single[0], inputs[1], single[1], out, n);
+        return true;
+    }
+
+    const char* kindName() const {
+        return "calculus";
+    }
+
+    vector<string> fields() const {
+        return {operandText(operands[0]), operandText(operands[1]), string(1, operation)};
+    }
+
+    void writeOutput(OutputSink& out) {
+    try {
+        if (isColumnar()) {
+            const vector<double>* values = output.column.get();
+            out.printf("The result is: %zu values, %zu errors\n", values ? values->size() : 0, errors);
+            for (size_t i = 0; values && i < values->size(); ++i) {
+                out.printf("%g\n", (*values)[i]);
+            }
+        } else {
+            out.printf("The result is: %f\n", result);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error writing to the file: " << e.what() << std::endl;
+    }
+}
+
+private:
+    bool isColumnar() const {
+        return operands[0].kind != StepValue::NUMBER || operands[1].kind != StepValue::NUMBER;
+    }
+
+    static string operandText(const StepInput& operand) {
+        return to_string(operand.step) + (operand.column.empty() ? "" : "." + operand.column);
+    }
+
+    void executeColumns() {
+        output.kind = StepValue::COLUMN;
+        output.column = nullptr;
+        errors = 0;
+
+        ColumnOperation op;
+        if (!columnOperationFor(operation, op)) {
+            console() << "Invalid operation!" << std::endl;
+            return;
+        }
+
+        const double* data[2];
+        bool single[2];
+        size_t length = 1;
+        bool columnar = false;
+
+        for (int i = 0; i < 2; ++i) {
+            single[i] = operands[i].kind == StepValue::NUMBER;
+            if (single[i]) {
+                data[i] = &numbersFromSteps[i];
+                continue;
+            }
+            if (!columnsFromSteps[i]) {
+                std::cerr << "Column '" << operands[i].column << "' not found in step " << operands[i].step << ".\n";
+                return;
+            }
+            if (columnar && columnsFromSteps[i]->size() != length) {
+                std::cerr << "Columns have different lengths (" << length << " and "
+                          << columnsFromSteps[i]->size() << ").\n";
+                return;
+            }
+            data[i] = columnsFromSteps[i]->data();
+            length = columnsFromSteps[i]->size();
+            columnar = true;
+        }
+
+        auto values = make_shared<vector<double>>(length);
+        errors = applyColumnOperation(op, data[0], single[0], data[1], single[1], values->data(), length);
+        output.column = values;
+        replay();
+    }
+};
+
+class ExpressionStep : public Step {
+private:
+    string formula;
+    Expression program;
+    vector<StepInput> inputs;
+    vector<double> registers;
+    vector<shared_ptr<const vector<double>>> columnsFromSteps;
+    bool columnar;
+    double result;
+    size_t errors;
+
+public:
+    // kindOf gives the output kind of the step at a position (NONE when there is no such
+    // step), so that every reference can be checked and typed when the step is built
+    ExpressionStep(const string& f, const function<StepValue::Kind(size_t)>& kindOf)
+        : formula(f), columnar(false), result(0), errors(0) {
+        if (!program.compile(formula)) {
+            return;
+        }
+
+        for (const Expression::Reference& reference : program.getReferences()) {
+            StepValue::Kind kind = kindOf(reference.step);
+            bool usable = reference.column.empty() ? kind == StepValue::NUMBER || kind == StepValue::COLUMN
+                                                   : kind == StepValue::TABLE;
+            if (!usable) {
+                inputs.clear();
+                return;
+            }
+            inputs.push_back({reference.step, kind, reference.column});
+            columnar = columnar || kind != StepValue::NUMBER;
+        }
+
+        program.prepareRegisters(registers);
+        columnsFromSteps.resize(inputs.size());
+    }
+
+    // False when the formula does not parse or refers to steps it cannot read
+    bool isValid() const {
+        return program.error().empty() && inputs.size() == program.getReferences().size();
+    }
+
+    string error() const {
+        return program.error().empty() ? "formula refers to a step that does not produce a number or column"
+                                       : program.error();
+    }
+
+    vector<StepInput> getInputs() const {
+        return inputs;
+    }
+
+    void setInputs(const vector<const StepValue*>& values) {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            registers[i] = values[i]->number;
+            columnsFromSteps[i] = nullptr;
+            if (inputs[i].kind == StepValue::COLUMN) {
+                columnsFromSteps[i] = values[i]->column;
+            } else if (inputs[i].kind == StepValue::TABLE && values[i]->table) {
+                columnsFromSteps[i] = values[i]->table->column(inputs[i].column);
+            }
+        }
+    }
+
+    StepValue::Kind outputKind() const {
+        return columnar ? StepValue::COLUMN : StepValue::NUMBER;
+    }
+
+    bool isPure() const {
+        return true;
+    }
+
+    void replay() {
+        console() << "The result of '" << formula << "' is: ";
+        if (columnar) {
+            console() << (output.column ? output.column->size() : 0) << " values, " << errors << " errors" << endl;
+        } else {
+            console() << result << endl;
+        }
+    }
+
+    void execute() {
+        if (!isValid()) {
+            std::cerr << "Invalid formula '" << formula << "': " << error() << ".\n";
+            return;
+        }
+
+        if (!columnar) {
+            result = program.evaluate(registers.data());
+            errors = std::isnan(result);
+            output.kind = StepValue::NUMBER;
+            output.number = result;
+            replay();
+            return;
+        }
+
+        vector<const double*> data(inputs.size());
+        vector<bool> single(inputs.size());
+        size_t length = 1;
+        bool sized = false;
+        output.kind = StepValue::COLUMN;
+        output.column = nullptr;
+
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            single[i] = inputs[i].kind == StepValue::NUMBER;
+            if (single[i]) {
+                data[i] = &registers[i];
+                continue;
+            }
+            if (!columnsFromSteps[i]) {
+                std::cerr << "Column '" << inputs[i].column << "' not found in step " << inputs[i].step << ".\n";
+                return;
+            }
+            if (sized && columnsFromSteps[i]->size() != length) {
+                std::cerr << "Columns have different lengths (" << length << " and "
+                          << columnsFromSteps[i]->size() << ").\n";
+                return;
+            }
+            data[i] = columnsFromSteps[i]->data();
+            length = columnsFromSteps[i]->size();
+            sized = true;
+        }
+
+        auto values = make_shared<vector<double>>(length);
+        errors = program.evaluateColumns(data, single, length, values->data());
+        output.column = values;
+        replay();
+    }
+
+    bool evaluateRows(const vector<const double*>& inputs, const vector<bool>& single, size_t n,
+                      double* out) const {
+        if (!isValid() || columnar) {
+            return false;
+        }
+        program.evaluateColumns(inputs, single, n, out);
+        return true;
+    }
+
+    const char* kindName() const {
+        return "expression";
+    }
+
+    vector<string> fields() const {
+        return {formula};
+    }
+
+    void writeOutput(OutputSink& out) {
+        if (columnar) {
+            const vector<double>* values = output.column.get();
+            out.printf("The result of '%s' is: %zu values, %zu errors\n", formula.c_str(),
+                       values ? values->size() : 0, errors);
+            for (size_t i = 0; values && i < values->size(); ++i) {
+                out.printf("%g\n", (*values)[i]);
+            }
+        } else {
+            out.printf("The result of '%s' is: %f\n", formula.c_str(), result);
+        }
+    }
+};
+
+// Shows a file, or with a name starting with '@' the stream of an earlier step as it
+// arrives
+class DisplayStep : public Step {
+private:
+    string fName;
+    StepInput stream;
+    shared_ptr<ChunkChannel> channel;
+    size_t streamed;
+
+    // File the name resolved to, found once and kept until it can no longer be opened
+    string resolvedName;
+
+public:
+    DisplayStep(string& s) : fName(s), stream{0, StepValue::NONE, ""}, streamed(0) {}
+
+    // The stream named s, published by the step at position streamStep
+    DisplayStep(const string& s, size_t streamStep) : fName(s), stream{streamStep, StepValue::STREAM, ""}, streamed(0) {}
+
+    vector<StepInput> getInputs() const {
+        return isStream() ? vector<StepInput>{stream} : vector<StepInput>();
+    }
+
+    void setInputs(const vector<const StepValue*>& values) {
+        channel = values.empty() ? nullptr : values[0]->channel;
+    }
+
+    vector<string> filesRead() const {
+        return isStream() ? vector<string>() : vector<string>{fName + ".txt", fName + ".csv"};
+    }
+
+    void execute() {
+        if (isStream()) {
+            displayStream();
+            return;
+        }
+
+        int inputFile = openResolved();
+
+        // If file doesn't exist with either .txt or .csv extension
+        if (inputFile < 0) {
+            std::cerr << "File '" << fName << "' not found.\n";
+            return;
+        }
+
+        displayFileContents(inputFile);
+        close(inputFile);
+    }
+
+    const char* kindName() const {
+        return "display";
+    }
+
+    vector<string> fields() const {
+        return {fName};
+    }
+
+    void writeOutput(OutputSink& out) {
+        // A stream is gone once shown
+        if (isStream()) {
+            out.printf("Stream '%s' displayed: %zu bytes\n", fName.c_str(), streamed);
+            return;
+        }
+
+        // fName is left untouched so the step can run again
+        int inputFile = openResolved();
+
+        if (inputFile >= 0 && out.isOpen()) { // Ensure both files are open
+            out << "Content of file '" << resolvedName << "':\n"; // Write header
+
+            // The output stays open for the steps after this one
+            bool copied = out.copyFrom(inputFile);
+            close(inputFile);
+
+            if (copied) {
+                console() << "Content of file '" << resolvedName << "' written to the output file successfully.\n";
+            } else {
+                std::cerr << "Unable to copy file '" << resolvedName << "' to the output file.\n";
+            }
+        } else {
+            if (inputFile >= 0) {
+                close(inputFile);
+            }
+            std::cerr << "Unable to open either file '" << fName << "' or the provided output file.\n";
+        }
+    }
+
+private:
+    bool isStream() const {
+        return stream.kind == StepValue::STREAM;
+    }
+
+    void displayStream() {
+        console() << "Content of stream '" << fName << "':\n";
+        streamed = 0;
+        if (!channel) {
+            return;
+        }
+
+        string_view chunk;
+        char last = '\n';
+        while (channel->next(chunk)) {
+            console().write(chunk.data(), chunk.size());
+            streamed += chunk.size();
+            last = chunk.empty() ? last : chunk.back();
+            channel->release();
+        }
+        if (last != '\n') {
+            console() << '\n';
+        }
+    }
+
+    // Open the file to display, probing for the .txt and then the .csv file only when
+    // nothing is resolved yet or the resolved file has gone away
+    int openResolved() {
+        if (!resolvedName.empty()) {
+            int fd = open(resolvedName.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                return fd;
+            }
+            resolvedName.clear();
+        }
+
+        for (const char* extension : {".txt", ".csv"}) {
+            string candidate = fName + extension;
+            struct stat info;
+            if (stat(candidate.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+                int fd = open(candidate.c_str(), O_RDONLY);
+                if (fd >= 0) {
+                    resolvedName = candidate;
+                    return fd;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Helper function to display file contents; goes straight from the file to stdout in
+    // the kernel unless the console is being buffered
+    void displayFileContents(int inputFile) const {
+        console() << "Content of file '" << resolvedName << "':\n";
+
+        bool copied;
+        if (&console() == &cout) {
+            cout.flush();
+            fflush(stdout);
+            copied = copyDescriptor(inputFile, STDOUT_FILENO);
+        } else {
+            vector<char> block(1 << 20);
+            ssize_t n;
+            while ((n = read(inputFile, block.data(), block.size())) > 0) {
+                threadCounters.bytesRead += n;
+                console().write(block.data(), n);
+            }
+            copied = n == 0;
+        }
+
+        if (!copied) {
+            std::cerr << "Unable to read file '" << resolvedName << "'.\n";
+            return;
+        }
+
+        // Like a line-by-line display, always finish with a newline
+        struct stat info;
+        char last = '\n';
+        if (fstat(inputFile, &info) == 0 && info.st_size > 0 && pread(inputFile, &last, 1, info.st_size - 1) != 1) {
+            last = '\n';
+        }
+        if (last != '\n') {
+            console() << '\n';
+        }
+    }
+};
+
+// Reads a text file (e.g. a log) and counts its lines, words, tokens and bytes; how often
+// each token occurs goes to <file name>.tokens.csv, most frequent first
+class TextFileInputStep : public Step {
+private:
+    string description, fileName, tokensFile;
+    shared_ptr<const TextStats> stats; // shared, so that moving the step stays cheap
+    size_t distinctTokens;
+
+public:
+    TextFileInputStep(const string& desc, const string& fName)
+        : description(desc), fileName(fName + ".txt"), tokensFile(fName + ".tokens.csv"), distinctTokens(0) {
+        static const shared_ptr<const TextStats> none = make_shared<TextStats>();
+        stats = none;
+    }
+
+    vector<string> filesRead() const {
+        return {fileName};
+    }
+
+    vector<string> filesWritten() const {
+        return {tokensFile};
+    }
+
+    // Publishes the token counts as a table (columns token and count), with the token file
+    // name as its text and the line count as its number
+    StepValue::Kind outputKind() const {
+        return StepValue::TABLE;
+    }
+
+    string inputFingerprint() const {
+        return fileFingerprint(fileName);
+    }
+
+    bool isPure() const {
+        return true;
+    }
+
+    void execute() {
+        output = StepValue();
+        MappedFile file(fileName);
+        if (!file.isOpen()) {
+            std::cerr << "Unable to open TXT file '" << fileName << "'.\n";
+            return;
+        }
+
+        TextIngest ingest;
+        ingest.run(file);
+        stats = make_shared<TextStats>(ingest.stats);
+        distinctTokens = ingest.tokens.size();
+
+        OutputSink out(tokensFile);
+        out << "token,count\n";
+        for (const auto& token : ingest.tokens) {
+            out << token.first << ',' << to_string(token.second) << '\n';
+        }
+        out.flush();
+        if (!out.isOpen()) {
+            std::cerr << "Unable to write token file '" << tokensFile << "'.\n";
+            return;
+        }
+
+        publish();
+        replay();
+    }
+
+    bool saveResult(string& blob) const {
+        if (output.kind != StepValue::TABLE) {
+            return false;
+        }
+        uint64_t distinct = distinctTokens;
+        appendBytes(blob, stats.get(), sizeof(TextStats));
+        appendBytes(blob, &distinct, 8);
+        appendString(blob, fileFingerprint(tokensFile));
+        return true;
+    }
+
+    // The token file itself is not saved, so a result only holds while the token file
+    // written with it is still in place
+    bool loadResult(string_view blob) {
+        TextStats saved;
+        uint64_t distinct;
+        string written;
+        if (!takeBytes(blob, &saved, sizeof(saved)) || !takeBytes(blob, &distinct, 8) || !takeString(blob, written) ||
+            written != fileFingerprint(tokensFile)) {
+            return false;
+        }
+        stats = make_shared<TextStats>(saved);
+        distinctTokens = distinct;
+        publish();
+        return true;
+    }
+
+    void replay() {
+        console() << "TXT file '" << fileName << "' read: " << stats->lines << " lines, " << stats->words
+                  << " words, " << stats->tokens << " tokens (" << distinctTokens << " distinct), "
+                  << stats->bytes << " bytes.\n";
+    }
+
+    const TextStats& getStats() const {
+        return *stats;
+    }
+
+    const char* kindName() const {
+        return "textfile";
+    }
+
+    vector<string> fields() const {
+        return {description, fileName.substr(0, fileName.size() - 4)};
+    }
+
+private:
+    void publish() {
+        output.kind = StepValue::TABLE;
+        output.text = tokensFile;
+        output.number = stats->lines;
+        output.table = make_shared<CsvTable>(tokensFile, vector<string>{"token", "count"});
+    }
+
+public:
+    void writeOutput(OutputSink& out) {
+        uint64_t nonAscii = stats->countBytes([](unsigned char c) { return c >= 0x80; });
+        uint64_t control = stats->countBytes([](unsigned char c) { return c < 0x20 && !isspace(c); });
+        out.printf("%s: %llu lines (%llu empty, longest %llu bytes), %llu words, %llu tokens (%zu distinct), "
+                   "%llu bytes (%llu non-ASCII, %llu control)\n",
+                   description.c_str(), (unsigned long long)stats->lines, (unsigned long long)stats->emptyLines,
+                   (unsigned long long)stats->longestLine, (unsigned long long)stats->words,
+                   (unsigned long long)stats->tokens, distinctTokens, (unsigned long long)stats->bytes,
+                   (unsigned long long)nonAscii, (unsigned long long)control);
+    }
+};
+
+class CsvFileInputStep : public Step {
+private:
+    string description, fileName;
+    vector<string> header;
+    size_t rowCount;
+    shared_ptr<const ColumnStore> store;
+
+public:
+    CsvFileInputStep(const std::string& desc, const std::string& fName)
+        : description(desc), fileName(fName + ".csv"), rowCount(0) {}
+
+    void execute() {
+        output = StepValue();
+
+        // The columnar sidecar has the header and row count, so the text is parsed only
+        // the first time the file is read
+        store = ColumnStore::forCsv(fileName);
+        if (store) {
+            header = store->getHeader();
+            rowCount = store->rowCount();
+            publish();
+            replay();
+            return;
+        }
+
+        CsvReader reader(fileName);
+
+        if (!reader.isOpen()) {
+            std::cerr << "Unable to open CSV file '" << fileName << "'.\n";
+            return;
+        }
+
+        // First row names the columns, every other row is data
+        header.clear();
+        rowCount = 0;
+        if (reader.nextRow()) {
+            for (size_t i = 0; i < reader.fields().size(); ++i) {
+                string_view name = reader.fields()[i];
+                header.push_back(reader.isQuoted(i) ? CsvReader::unquote(name) : string(name));
+            }
+        }
+        while (reader.nextRow()) {
+            ++rowCount;
+        }
+
+        publish();
+        replay();
+    }
+
+    bool saveResult(string& blob) const {
+        if (output.kind != StepValue::TABLE) {
+            return false;
+        }
+        uint64_t rows = rowCount, columns = header.size();
+        appendBytes(blob, &rows, 8);
+        appendBytes(blob, &columns, 8);
+        for (const string& name : header) {
+            appendString(blob, name);
+        }
+        return true;
+    }
+
+    bool loadResult(string_view blob) {
+        uint64_t rows, columns;
+        if (!takeBytes(blob, &rows, 8) || !takeBytes(blob, &columns, 8) || columns > blob.size() / 4) {
+            return false;
+        }
+        vector<string> names(columns);
+        for (string& name : names) {
+            if (!takeString(blob, name)) {
+                return false;
+            }
+        }
+        rowCount = rows;
+        header = std::move(names);
+        store = ColumnStore::forCsv(fileName, false);
+        publish();
+        return true;
+    }
+
+    // Publishes the file as a table whose numeric columns later steps can read, with the
+    // file name as its text and the row count as its number
+    StepValue::Kind outputKind() const {
+        return StepValue::TABLE;
+    }
+
+    string inputFingerprint() const {
+        return fileFingerprint(fileName);
+    }
+
+    bool isPure() const {
+        return true;
+    }
+
+    vector<string> filesRead() const {
+        return {fileName};
+    }
+
+    void replay() {
+        console() << "CSV file '" << fileName << "' read: " << rowCount << " rows, "
+                  << header.size() << " columns.\n";
+    }
+
+    const vector<string>& getHeader() const {
+        return header;
+    }
+
+    size_t getRowCount() const {
+        return rowCount;
+    }
+
+    const string& getFileName() const {
+        return fileName;
+    }
+
+    const char* kindName() const {
+        return "csvfile";
+    }
+
+    vector<string> fields() const {
+        return {description, fileName.substr(0, fileName.size() - 4)};
+    }
+
+    void writeOutput(OutputSink& out) {
+        out.printf("%s: %zu rows, %zu columns\n", description.c_str(), rowCount, header.size());
+    }
+
+private:
+    void publish() {
+        output.kind = StepValue::TABLE;
+        output.text = fileName;
+        output.number = rowCount;
+        output.table = make_shared<CsvTable>(fileName, header, store);
+    }
+};
+
+// Groups the rows of a CSV read by an earlier step by one or more key columns and writes
+// the count of rows and the sum, min, max and mean of each value column per group to
+// <output name>.csv, which display steps can show and later steps read like any other CSV.
+// The rows may also come from the stream of an earlier step, and an output name starting
+// with '@' streams the groups to a later step instead of writing a file.
+class AggregateStep : public Step {
+private:
+    StepInput source;
+    string keyList, valueList, outputName, fileName;
+    size_t memoryMegabytes;
+    vector<string> keyColumns, valueColumns;
+    string sourceFile;
+    vector<string> sourceHeader;
+    shared_ptr<ChunkChannel> sourceStream;
+    size_t rows, groups, spills;
+
+public:
+    // Key and value columns are comma-separated lists of column names of the CSV (TABLE) or
+    // stream (STREAM) step input refers to; past memoryMegabytes, groups are spilled to disk
+    AggregateStep(StepInput input, const string& keys, const string& values, const string& output,
+                  size_t memoryMegabytes = 64)
+        : source(input), keyList(keys), valueList(values), outputName(output),
+          fileName(isStreamName(output) ? output : output + ".csv"), memoryMegabytes(memoryMegabytes), rows(0),
+          groups(0), spills(0) {
+        keyColumns = splitList(keys);
+        valueColumns = splitList(values);
+    }
+
+    vector<StepInput> getInputs() const {
+        return {source};
+    }
+
+    void setInputs(const vector<const StepValue*>& values) {
+        sourceFile = values[0]->text;
+        sourceHeader = values[0]->table ? values[0]->table->getHeader() : vector<string>();
+        sourceStream = values[0]->channel;
+        if (isStreamName(outputName)) {
+            openStream(outputName);
+        }
+    }
+
+    // Publishes the grouped CSV as a table, with its file name as text and the number of
+    // groups as number, or streams it
+    StepValue::Kind outputKind() const {
+        return isStreamName(outputName) ? StepValue::STREAM : StepValue::TABLE;
+    }
+
+    string streamName() const {
+        return isStreamName(outputName) ? outputName : "";
+    }
+
+    // A stream has to be produced again every time, and so does whatever reads one
+    bool isPure() const {
+        return !isStreamName(outputName) && source.kind != StepValue::STREAM;
+    }
+
+    vector<string> filesWritten() const {
+        return isStreamName(outputName) ? vector<string>() : vector<string>{fileName};
+    }
+
+    void replay() {
+        console() << "Aggregated " << rows << " rows of '" << sourceFile << "' into " << groups << " groups in '"
+                  << fileName << "'";
+        if (spills) {
+            console() << " (" << spills << " spills)";
+        }
+        console() << ".\n";
+    }
+
+    void execute() {
+        bool streaming = isStreamName(outputName);
+        if (!streaming) {
+            output = StepValue();
+        }
+        rows = groups = spills = 0;
+
+        unique_ptr<CsvReader> source(sourceStream ? new CsvReader(sourceStream) : new CsvReader(sourceFile));
+        CsvReader& reader = *source;
+        if (!reader.isOpen()) {
+            std::cerr << "Unable to open CSV file '" << sourceFile << "'.\n";
+            return;
+        }
+
+        // A stream names its columns in its first row
+        reader.nextRow();
+        if (sourceStream) {
+            sourceHeader.clear();
+            for (size_t i = 0; i < reader.fields().size(); ++i) {
+                string_view name = reader.fields()[i];
+                sourceHeader.push_back(reader.isQuoted(i) ? CsvReader::unquote(name) : string(name));
+            }
+        }
+
+        vector<size_t> keyIndex, valueIndex;
+        if (!columnIndexes(keyColumns, keyIndex) || !columnIndexes(valueColumns, valueIndex)) {
+            return;
+        }
+
+        // Keys of several columns are joined with a unit separator, which CSV text lacks
+        GroupAggregator aggregator(valueIndex.size(), memoryMegabytes << 20, fileName);
+        vector<double> values(valueIndex.size());
+        string key;
+        while (reader.nextRow()) {
+            const vector<string_view>& fields = reader.fields();
+            key.clear();
+            for (size_t k = 0; k < keyIndex.size(); ++k) {
+                if (k) {
+                    key += '\x1f';
+                }
+                size_t index = keyIndex[k];
+                if (index < fields.size()) {
+                    if (reader.isQuoted(index)) {
+                        key += CsvReader::unquote(fields[index]);
+                    } else {
+                        key.append(fields[index]);
+                    }
+                }
+            }
+            for (size_t v = 0; v < valueIndex.size(); ++v) {
+                values[v] = valueIndex[v] < fields.size() ? CsvReader::parseNumber(fields[valueIndex[v]])
+                                                          : std::numeric_limits<double>::quiet_NaN();
+            }
+            aggregator.add(key, values.data());
+            ++rows;
+        }
+
+        unique_ptr<OutputSink> sink(streaming ? new OutputSink(output.channel) : new OutputSink(fileName));
+        OutputSink& out = *sink;
+        vector<string> header = keyColumns;
+        header.push_back("count");
+        for (const string& name : valueColumns) {
+            for (const char* total : {"sum_", "min_", "max_", "mean_"}) {
+                header.push_back(total + name);
+            }
+        }
+        for (size_t i = 0; i < header.size(); ++i) {
+            if (i) {
+                out << ',';
+            }
+            writeField(out, header[i]);
+        }
+        out << '\n';
+
+        bool finished = aggregator.finish([&](string_view groupKey, uint64_t groupRows,
+                                              const GroupAggregator::Totals* totals) {
+            for (size_t start = 0, k = 0; k < keyIndex.size(); ++k) {
+                size_t end = groupKey.find('\x1f', start);
+                end = end == string_view::npos ? groupKey.size() : end;
+                writeField(out, groupKey.substr(start, end - start));
+                out << ',';
+                start = end + 1;
+            }
+            out << to_string(groupRows);
+            for (size_t v = 0; v < valueIndex.size(); ++v) {
+                const GroupAggregator::Totals& t = totals[v];
+                out << ',';
+                writeNumber(out, t.sum);
+                out << ',';
+                if (t.count) {
+                    writeNumber(out, t.min);
+                    out << ',';
+                    writeNumber(out, t.max);
+                    out << ',';
+                    writeNumber(out, t.sum / t.count);
+                } else {
+                    out << ",,";
+                }
+            }
+            out << '\n';
+            ++groups;
+        });
+        spills = aggregator.spillCount();
+        out.flush();
+
+        if (!finished || !out.isOpen()) {
+            std::cerr << "Unable to write aggregate " << (streaming ? "stream" : "file") << " '" << fileName
+                      << "'.\n";
+            return;
+        }
+
+        output.number = groups;
+        if (!streaming) {
+            output.kind = StepValue::TABLE;
+            output.text = fileName;
+            output.table = make_shared<CsvTable>(fileName, header);
+        }
+        replay();
+    }
+
+    const char* kindName() const {
+        return "aggregate";
+    }
+
+    vector<string> fields() const {
+        return {to_string(source.step), keyList, valueList, outputName, to_string(memoryMegabytes)};
+    }
+
+    // The grouped rows go into the report as well, unless they were streamed
+    void writeOutput(OutputSink& out) {
+        out.printf("Aggregate of '%s' by %s: %zu groups\n", sourceFile.c_str(), keyList.c_str(), groups);
+        int fd = isStreamName(outputName) ? -1 : open(fileName.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            out.copyFrom(fd);
+            close(fd);
+        }
+    }
+
+private:
+    static vector<string> splitList(const string& list) {
+        vector<string> names;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = list.find(',', start);
+            end = end == string::npos ? list.size() : end;
+            if (end > start) {
+                names.push_back(list.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+        return names;
+    }
+
+    bool columnIndexes(const vector<string>& names, vector<size_t>& indexes) const {
+        for (const string& name : names) {
+            size_t index = find(sourceHeader.begin(), sourceHeader.end(), name) - sourceHeader.begin();
+            if (index == sourceHeader.size()) {
+                std::cerr << "Column '" << name << "' not found in '" << sourceFile << "'.\n";
+                return false;
+            }
+            indexes.push_back(index);
+        }
+        return true;
+    }
+
+    static void writeField(OutputSink& out, string_view field) {
+        if (field.find_first_of(",\"\r\n") == string_view::npos) {
+            out << field;
+            return;
+        }
+        out << '"';
+        for (char c : field) {
+            if (c == '"') {
+                out << '"';
+            }
+            out << c;
+        }
+        out << '"';
+    }
+
+    static void writeNumber(OutputSink& out, double value) {
+        char text[32];
+        auto written = std::to_chars(text, text + sizeof(text), value);
+        out.write(text, written.ptr - text);
+    }
+};
+
+// Pulls the rows of a CSV read by an earlier step whose key column equals a key, or lies
+// between a first and a last key, into <output name>.csv, found through the column's key
+// index (see CsvIndex) rather than by reading the CSV. The rows keep their text and file
+// order for equal keys and come out in key order; later steps read the file like any other
+// CSV. An output name starting with '@' streams the rows to a later step instead.
+class LookupStep : public Step {
+private:
+    StepInput source;
+    string keyColumn, outputName, firstKey, lastKey, fileName;
+    string sourceFile;
+    vector<string> sourceHeader;
+    size_t matches;
+
+public:
+    // Without a last key, a point lookup of first
+    LookupStep(size_t step, const string& column, const string& output, const string& first,
+               const string& last = "")
+        : source{step, StepValue::TABLE, ""}, keyColumn(column), outputName(output), firstKey(first), lastKey(last),
+          fileName(isStreamName(output) ? output : output + ".csv"), matches(0) {}
+
+    vector<StepInput> getInputs() const {
+        return {source};
+    }
+
+    void setInputs(const vector<const StepValue*>& values) {
+        sourceFile = values[0]->text;
+        sourceHeader = values[0]->table ? values[0]->table->getHeader() : vector<string>();
+        if (isStreamName(outputName)) {
+            openStream(outputName);
+        }
+    }
+
+    // Publishes the rows found as a table, with the file name as text and the number of
+    // rows as number, or streams them
+    StepValue::Kind outputKind() const {
+        return isStreamName(outputName) ? StepValue::STREAM : StepValue::TABLE;
+    }
+
+    string streamName() const {
+        return isStreamName(outputName) ? outputName : "";
+    }
+
+    bool isPure() const {
+        return !isStreamName(outputName);
+    }
+
+    vector<string> filesWritten() const {
+        return isStreamName(outputName) ? vector<string>() : vector<string>{fileName};
+    }
+
+    void replay() {
+        console() << "Looked up " << describeKeys() << " in '" << sourceFile << "': " << matches << " rows in '"
+                  << fileName << "'.\n";
+    }
+
+    void execute() {
+        bool streaming = isStreamName(outputName);
+        if (!streaming) {
+            output = StepValue();
+        }
+        matches = 0;
+
+        size_t position = find(sourceHeader.begin(), sourceHeader.end(), keyColumn) - sourceHeader.begin();
+        if (position == sourceHeader.size()) {
+            std::cerr << "Column '" << keyColumn << "' not found in '" << sourceFile << "'.\n";
+            return;
+        }
+
+        CsvIndex index;
+        if (!index.open(sourceFile, keyColumn, position)) {
+            std::cerr << "Unable to index column '" << keyColumn << "' of '" << sourceFile << "'.\n";
+            return;
+        }
+
+        const string& last = lastKey.empty() ? firstKey : lastKey;
+        vector<uint64_t> offsets;
+        if (index.isNumeric()) {
+            double low = CsvReader::parseNumber(firstKey), high = CsvReader::parseNumber(last);
+            if (std::isnan(low) || std::isnan(high)) {
+                std::cerr << "Column '" << keyColumn << "' of '" << sourceFile << "' holds numbers, "
+                          << describeKeys() << " is not.\n";
+                return;
+            }
+            index.offsetsBetween(low, high, offsets);
+        } else {
+            index.offsetsBetween(firstKey, last, offsets);
+        }
+
+        unique_ptr<OutputSink> sink(streaming ? new OutputSink(output.channel) : new OutputSink(fileName));
+        OutputSink& out = *sink;
+        out << index.rowAt(0) << '\n';
+        for (uint64_t offset : offsets) {
+            out << index.rowAt(offset) << '\n';
+        }
+        out.flush();
+
+        if (!out.isOpen()) {
+            std::cerr << "Unable to write lookup " << (streaming ? "stream" : "file") << " '" << fileName << "'.\n";
+            return;
+        }
+
+        matches = offsets.size();
+        output.number = matches;
+        if (!streaming) {
+            output.kind = StepValue::TABLE;
+            output.text = fileName;
+            output.table = make_shared<CsvTable>(fileName, sourceHeader);
+        }
+        replay();
+    }
+
+    const char* kindName() const {
+        return "lookup";
+    }
+
+    vector<string> fields() const {
+        vector<string> values = {to_string(source.step), keyColumn, outputName, firstKey};
+        if (!lastKey.empty()) {
+            values.push_back(lastKey);
+        }
+        return values;
+    }
+
+    // The rows found go into the report as well, unless they were streamed
+    void writeOutput(OutputSink& out) {
+        out.printf("Lookup of %s in '%s': %zu rows\n", describeKeys().c_str(), sourceFile.c_str(), matches);
+        int fd = isStreamName(outputName) ? -1 : open(fileName.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            out.copyFrom(fd);
+            close(fd);
+        }
+    }
+
+private:
+    string describeKeys() const {
+        return keyColumn + (lastKey.empty() ? " = '" + firstKey + "'" : " from '" + firstKey + "' to '" + lastKey + "'");
+    }
+};
+
+// Writes a report with a title, a description and information. Each of them, and the file
+// name, may hold placeholders for the results of earlier steps (see ReportTemplate). When
+// they refer to columns of a CSV step, one report is rendered per record of that CSV on
+// all cores (a mail merge): into a file per record if the file name has a placeholder,
+// such as invoice_{{s1.id}}.txt, otherwise one after another into the one file.
+class OutputStep : public Step {
+private:
+    string fName, title, description, information;
+    vector<ReportTemplate::Reference> references;
+    ReportTemplate nameTemplate, bodyTemplate;
+    vector<StepInput> inputs;
+    string templateError;
+    vector<string> values;          // text of every reference that is not a column
+    string recordFile;              // CSV whose records are rendered, if any
+    vector<string> recordHeader;
+
+public:
+    // kindOf gives the output kind of the step at a position (NONE when there is no such
+    // step); without it, the texts may not refer to other steps
+    OutputStep(const string& file, const string& t, const string& desc, const string& info,
+               const function<StepValue::Kind(size_t)>& kindOf = nullptr) :
+        fName(file), title(t), description(desc), information(info) {
+        string body = "Title: " + title + "\n\nDescription: " + description + "\n\nInformation: " + information + "\n";
+        if (!nameTemplate.parse(fName, references) || !bodyTemplate.parse(body, references)) {
+            templateError = nameTemplate.error().empty() ? bodyTemplate.error() : nameTemplate.error();
+            return;
+        }
+
+        size_t recordStep = 0;
+        for (const ReportTemplate::Reference& reference : references) {
+            StepValue::Kind kind = kindOf ? kindOf(reference.step) : StepValue::NONE;
+            string placeholder = "{{s" + to_string(reference.step) +
+                                 (reference.column.empty() ? "" : "." + reference.column) + "}}";
+            if (kind == StepValue::STREAM) {
+                templateError = placeholder + " refers to a stream, which only display and aggregate steps read";
+                return;
+            }
+            if (reference.column.empty() ? kind == StepValue::NONE : kind != StepValue::TABLE) {
+                templateError = placeholder + " does not refer to an earlier step with a result" +
+                                (reference.column.empty() ? "" : " table");
+                return;
+            }
+            if (!reference.column.empty() && !recordFile.empty() && reference.step != recordStep) {
+                templateError = "placeholders read records of more than one CSV step";
+                return;
+            }
+            if (!reference.column.empty()) {
+                recordStep = reference.step;
+                recordFile = "?";   // set to the CSV file name when the flow runs
+            }
+            inputs.push_back({reference.step, kind, reference.column});
+        }
+        values.resize(references.size());
+    }
+
+    // False when a text does not parse or refers to steps it cannot read
+    bool isValid() const {
+        return templateError.empty();
+    }
+
+    const string& error() const {
+        return templateError;
+    }
+
+    vector<StepInput> getInputs() const {
+        return inputs;
+    }
+
+    void setInputs(const vector<const StepValue*>& stepValues) {
+        for (size_t i = 0; i < references.size(); ++i) {
+            const StepValue& value = *stepValues[i];
+            if (!references[i].column.empty()) {
+                recordFile = value.text;
+                recordHeader = value.table ? value.table->getHeader() : vector<string>();
+                continue;
+            }
+
+            char number[32];
+            switch (value.kind) {
+                case StepValue::TEXT:
+                    values[i] = value.text;
+                    break;
+                case StepValue::COLUMN:
+                    values[i] = to_string(value.column ? value.column->size() : 0);
+                    break;
+                default:
+                    values[i].assign(number, std::to_chars(number, number + sizeof(number), value.number).ptr);
+            }
+        }
+    }
+
+    vector<string> filesWritten() const {
+        return {fName};
+    }
+
+    void execute() {
+        if (!isValid()) {
+            std::cerr << "Invalid report template in '" << fName << "': " << templateError << ".\n";
+            return;
+        }
+
+        vector<string_view> views(values.begin(), values.end());
+        if (!recordFile.empty()) {
+            renderRecords(views);
+            return;
+        }
+
+        string name, body;
+        nameTemplate.render(views.data(), 1, name);
+        bodyTemplate.render(views.data(), 1, body);
+        if (writeFile(name, body)) {
+            console() << "File '" << name << "' created and data written successfully.\n";
+        } else {
+            std::cerr << "Unable to create/open file '" << name << "'.\n";
+        }
+    }
+
+    const char* kindName() const {
+        return "output";
+    }
+
+    vector<string> fields() const {
+        return {fName, title, description, information};
+    }
+
+    void writeOutput(OutputSink& /*out*/) {}
+
+private:
+    static bool writeFile(const string& name, string_view data) {
+        int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = true;
+        for (size_t done = 0; ok && done < data.size();) {
+            ssize_t written = write(fd, data.data() + done, data.size() - done);
+            ok = written > 0;
+            done += ok ? written : 0;
+        }
+        threadCounters.bytesWritten += data.size();
+        return close(fd) == 0 && ok;
+    }
+
+    // One report per record of the CSV, rendered in blocks of records on the thread pool
+    void renderRecords(vector<string_view>& views) {
+        CsvReader reader(recordFile);
+        if (!reader.isOpen()) {
+            std::cerr << "Unable to open CSV file '" << recordFile << "'.\n";
+            return;
+        }
+
+        vector<size_t> fieldReferences, columns;
+        for (size_t i = 0; i < references.size(); ++i) {
+            if (references[i].column.empty()) {
+                continue;
+            }
+            size_t index = find(recordHeader.begin(), recordHeader.end(), references[i].column) - recordHeader.begin();
+            if (index == recordHeader.size()) {
+                std::cerr << "Column '" << references[i].column << "' not found in '" << recordFile << "'.\n";
+                return;
+            }
+            fieldReferences.push_back(i);
+            columns.push_back(index);
+        }
+
+        // The fields every record needs, as views into the CSV; only fields holding doubled
+        // quotes are copied out
+        vector<string_view> fields;
+        std::deque<string> unquoted;
+        size_t records = 0;
+        reader.nextRow(); // header
+        while (reader.nextRow()) {
+            for (size_t column : columns) {
+                bool present = column < reader.fields().size();
+                string_view field = present ? reader.fields()[column] : string_view();
+                if (present && reader.isQuoted(column) && field.find('"') != string_view::npos) {
+                    unquoted.push_back(CsvReader::unquote(field));
+                    field = unquoted.back();
+                }
+                fields.push_back(field);
+            }
+            ++records;
+        }
+
+        const size_t BLOCK = 256;
+        size_t blocks = (records + BLOCK - 1) / BLOCK;
+        bool oneFile = !nameTemplate.isPerRecord();
+        vector<string> rendered(oneFile ? blocks : 0);
+        std::atomic<size_t> failed(0);
+
+        ThreadPool::shared().forEach(blocks, [&](size_t block) {
+            vector<string_view> record(views);
+            size_t first = block * BLOCK, last = std::min(records, first + BLOCK);
+            auto select = [&](size_t r) {
+                for (size_t k = 0; k < fieldReferences.size(); ++k) {
+                    record[fieldReferences[k]] = fields[r * columns.size() + k];
+                }
+            };
+
+            if (oneFile) {
+                size_t size = 0;
+                for (size_t r = first; r < last; ++r) {
+                    select(r);
+                    size += bodyTemplate.measure(record.data(), r + 1);
+                }
+                string& text = rendered[block];
+                text.resize(size);
+                char* out = &text[0];
+                for (size_t r = first; r < last; ++r) {
+                    select(r);
+                    out = bodyTemplate.fill(record.data(), r + 1, out);
+                }
+                return;
+            }
+
+            string name, body;
+            for (size_t r = first; r < last; ++r) {
+                select(r);
+                name.clear();
+                body.clear();
+                nameTemplate.render(record.data(), r + 1, name);
+                bodyTemplate.render(record.data(), r + 1, body);
+                if (!writeFile(name, body)) {
+                    ++failed;
+                }
+            }
+        });
+
+        if (oneFile) {
+            string name;
+            nameTemplate.render(views.data(), 1, name);
+            OutputSink out(name);
+            for (const string& text : rendered) {
+                out << text;
+            }
+            out.flush();
+            if (!out.isOpen()) {
+                return;
+            }
+            console() << "File '" << name << "' created with " << records << " reports.\n";
+        } else if (failed) {
+            std::cerr << "Unable to write " << failed << " of " << records << " reports '" << fName << "'.\n";
+        } else {
+            console() << records << " reports '" << fName << "' created successfully.\n";
+        }
+    }
+};
+
+using AnyStep = std::variant<TitleStep, TextStep, TextInputStep, NumberInputStep, CalculusStep, ExpressionStep,
+                             DisplayStep, TextFileInputStep, CsvFileInputStep, AggregateStep, LookupStep, OutputStep>;
+
+// Metrics
+
+string jsonString(const string& text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// Timing and resource use of flow runs, kept per step type and per flow while enabled.
+// Every step execution, replay and writeOutput() is measured for wall time, thread CPU
+// time, bytes read and written and allocations; latencies go into histograms, and every
+// measurement is also kept as a trace event (up to MAX_EVENTS, later ones are counted as
+// dropped). The results can be written as Prometheus text or as a Chrome trace_event file
+// (chrome://tracing, Perfetto). While disabled, a probe costs one relaxed atomic load.
+class FlowMetrics {
+public:
+    // Histogram bucket bounds are 1 us * 4^k seconds, k < BUCKETS, plus +Inf
+    static const int BUCKETS = 14;
+    static const size_t MAX_EVENTS = 1 << 20;
+
+    struct Usage {
+        double cpu;
+        uint64_t bytesRead;
+        uint64_t bytesWritten;
+        uint64_t allocations;
+    };
+
+private:
+    struct Histogram {
+        uint64_t buckets[BUCKETS + 1] = {};
+        uint64_t count = 0;
+        double sum = 0;
+
+        void add(double seconds) {
+            int bucket = 0;
+            for (double bound = 1e-6; bucket < BUCKETS && seconds > bound; bound *= 4) {
+                ++bucket;
+            }
+            ++buckets[bucket];
+            ++count;
+            sum += seconds;
+        }
+    };
+
+    struct StepTotals {
+        Histogram latency;
+        Usage usage = {};
+    };
+
+    struct TraceEvent {
+        string name;
+        const char* category;
+        string flow;
+        long step;
+        double start;       // microseconds since the metrics started
+        double duration;    // microseconds
+        int thread;
+        Usage usage;
+    };
+
+    std::atomic<bool> enabled;
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex lock;
+    map<tuple<string, string, string>, StepTotals> steps;   // by flow, step type and phase
+    map<string, Histogram> flows;
+    vector<TraceEvent> events;
+    size_t dropped;
+    std::atomic<int> nextThread;
+
+public:
+    FlowMetrics() : enabled(false), epoch(std::chrono::steady_clock::now()), dropped(0), nextThread(0) {}
+
+    static FlowMetrics& global() {
+        static FlowMetrics metrics;
+        return metrics;
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void enable(bool on) {
+        enabled.store(on, std::memory_order_relaxed);
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> guard(lock);
+        steps.clear();
+        flows.clear();
+        events.clear();
+        dropped = 0;
+    }
+
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Resources used by the calling thread so far
+    static Usage usage() {
+        struct timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        return {cpu.tv_sec + cpu.tv_nsec * 1e-9, threadCounters.bytesRead, threadCounters.bytesWritten,
+                threadCounters.allocations};
+    }
+
+    void recordStep(const string& flow, size_t step, const char* kind, const char* phase, double start,
+                    double end, const Usage& used) {
+        int thread = threadId();
+        std::lock_guard<std::mutex> guard(lock);
+        StepTotals& totals = steps[{flow, kind, phase}];
+        totals.latency.add((end - start) * 1e-6);
+        totals.usage.cpu += used.cpu;
+        totals.usage.bytesRead += used.bytesRead;
+        totals.usage.bytesWritten += used.bytesWritten;
+        totals.usage.allocations += used.allocations;
+        addEvent({string(kind) + " #" + to_string(step), phase, flow, (long)step, start, end - start, thread, used});
+    }
+
+    void recordFlow(const string& flow, double start, double end, const Usage& used) {
+        int thread = threadId();
+        std::lock_guard<std::mutex> guard(lock);
+        flows[flow].add((end - start) * 1e-6);
+        addEvent({flow, "flow", flow, -1, start, end - start, thread, used});
+    }
+
+    void writePrometheus(OutputSink& out) {
+        std::lock_guard<std::mutex> guard(lock);
+
+        out << "# HELP flow_step_seconds Wall time of step executions, replays and writes.\n"
+               "# TYPE flow_step_seconds histogram\n";
+        for (auto& entry : steps) {
+            string labels = "flow=" + labelValue(std::get<0>(entry.first)) + ",kind=" +
+                            labelValue(std::get<1>(entry.first)) + ",phase=" + labelValue(std::get<2>(entry.first));
+            writeHistogram(out, "flow_step_seconds", labels, entry.second.latency);
+        }
+
+        const char* counters[][2] = {
+            {"flow_step_cpu_seconds_total", "Thread CPU time of steps."},
+            {"flow_step_read_bytes_total", "Bytes steps read from files."},
+            {"flow_step_written_bytes_total", "Bytes steps wrote to files and reports."},
+            {"flow_step_allocations_total", "Heap allocations made by steps."},
+        };
+        for (int c = 0; c < 4; ++c) {
+            out << "# HELP " << counters[c][0] << ' ' << counters[c][1] << "\n# TYPE " << counters[c][0] << " counter\n";
+            for (auto& entry : steps) {
+                const Usage& used = entry.second.usage;
+                out << counters[c][0] << "{flow=" << labelValue(std::get<0>(entry.first)) << ",kind="
+                    << labelValue(std::get<1>(entry.first)) << ",phase=" << labelValue(std::get<2>(entry.first)) << "} ";
+                if (c == 0) {
+                    out.printf("%.9g\n", used.cpu);
+                } else {
+                    out << to_string(c == 1 ? used.bytesRead : c == 2 ? used.bytesWritten : used.allocations) << '\n';
+                }
+            }
+        }
+
+        out << "# HELP flow_run_seconds Wall time of whole flow runs.\n# TYPE flow_run_seconds histogram\n";
+        for (auto& entry : flows) {
+            writeHistogram(out, "flow_run_seconds", "flow=" + labelValue(entry.first), entry.second);
+        }
+
+        out << "# HELP flow_trace_events_dropped_total Trace events not kept because the trace was full.\n"
+               "# TYPE flow_trace_events_dropped_total counter\n"
+               "flow_trace_events_dropped_total " << to_string(dropped) << '\n';
+    }
+
+    void writeTrace(OutputSink& out) {
+        std::lock_guard<std::mutex> guard(lock);
+        int pid = getpid();
+
+        out << "{\"traceEvents\": [\n";
+        for (size_t i = 0; i < events.size(); ++i) {
+            const TraceEvent& event = events[i];
+            out << "{\"name\": " << jsonString(event.name) << ", \"cat\": \"" << event.category << '"';
+            out.printf(", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d", event.start,
+                       event.duration, pid, event.thread);
+            out << ", \"args\": {\"flow\": " << jsonString(event.flow);
+            if (event.step >= 0) {
+                out.printf(", \"step\": %ld", event.step);
+            }
+            out.printf(", \"cpu_us\": %.3f, \"bytes_read\": %llu, \"bytes_written\": %llu, \"allocations\": %llu}}%s\n",
+                       event.usage.cpu * 1e6, (unsigned long long)event.usage.bytesRead,
+                       (unsigned long long)event.usage.bytesWritten, (unsigned long long)event.usage.allocations,
+                       i + 1 < events.size() ? "," : "");
+        }
+        out << "], \"displayTimeUnit\": \"ms\"}\n";
+    }
+
+private:
+    // Small, stable number for the calling thread, as trace viewers expect
+    int threadId() {
+        static thread_local int id = -1;
+        if (id < 0) {
+            id = nextThread++;
+        }
+        return id;
+    }
+
+    void addEvent(TraceEvent event) {
+        if (events.size() < MAX_EVENTS) {
+            events.push_back(std::move(event));
+        } else {
+            ++dropped;
+        }
+    }
+
+    static string labelValue(const string& value) {
+        string quoted = "\"";
+        for (char c : value) {
+            if (c == '\\' || c == '"') {
+                quoted += '\\';
+                quoted += c;
+            } else if (c == '\n') {
+                quoted += "\\n";
+            } else {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    }
+
+    static void writeHistogram(OutputSink& out, const char* name, const string& labels, const Histogram& histogram) {
+        uint64_t cumulative = 0;
+        double bound = 1e-6;
+        for (int b = 0; b <= BUCKETS; ++b, bound *= 4) {
+            cumulative += histogram.buckets[b];
+            out << name << "_bucket{" << labels << ",le=\"";
+            if (b < BUCKETS) {
+                out.printf("%g", bound);
+            } else {
+                out << "+Inf";
+            }
+            out << "\"} " << to_string(cumulative) << '\n';
+        }
+        out << name << "_sum{" << labels << "} ";
+        out.printf("%.9g\n", histogram.sum);
+        out << name << "_count{" << labels << "} " << to_string(histogram.count) << '\n';
+    }
+};
+
+// Measures one phase of one step (or with no step, a whole flow run) from construction to
+// destruction, when metrics are enabled
+class MetricsProbe {
+private:
+    const string* flow;
+    size_t step;
+    const char* kind;
+    const char* phase;
+    double start;
+    FlowMetrics::Usage before;
+
+public:
+    MetricsProbe(const string& flowName, size_t position = 0, const char* stepKind = nullptr,
+                 const char* stepPhase = "execute")
+        : flow(nullptr), step(position), kind(stepKind), phase(stepPhase) {
+        FlowMetrics& metrics = FlowMetrics::global();
+        if (metrics.isEnabled()) {
+            flow = &flowName;
+            before = FlowMetrics::usage();
+            start = metrics.now();
+        }
+    }
+
+    ~MetricsProbe() {
+        if (!flow) {
+            return;
+        }
+        FlowMetrics& metrics = FlowMetrics::global();
+        double end = metrics.now();
+        FlowMetrics::Usage after = FlowMetrics::usage();
+        FlowMetrics::Usage used = {after.cpu - before.cpu, after.bytesRead - before.bytesRead,
+                                   after.bytesWritten - before.bytesWritten, after.allocations - before.allocations};
+        if (kind) {
+            metrics.recordStep(*flow, step, kind, phase, start, end, used);
+        } else {
+            metrics.recordFlow(*flow, start, end, used);
+        }
+    }
+
+    MetricsProbe(const MetricsProbe&) = delete;
+    MetricsProbe& operator=(const MetricsProbe&) = delete;
+
+    void setPhase(const char* stepPhase) {
+        phase = stepPhase;
+    }
+};
+
+// Result cache
+//
+// Results of file-backed steps kept on disk across runs and processes, one file per result
+// in a cache directory, named after a hash of its key. The key is the step's kind and
+// fields plus the identity of every file it reads (device, inode, size and modification
+// time, and with verification a hash of the contents), so a hit never opens the files the
+// step reads. Entries are written to a temporary file and renamed into place, and using
+// one touches its modification time; once the directory grows past its size cap the
+// least recently used entries are removed.
+//
+//   entry    "FLOWRC1\0", u32 key size, key, then the step's saved result
+class ResultCache {
+private:
+    string directory;
+    uint64_t capacity;
+    bool verify;
+
+    // Size and last use of the entries, read from the directory when it is first needed
+    struct Entry {
+        uint64_t size;
+        struct timespec used;
+    };
+    std::mutex lock;
+    map<string, Entry> entries;
+    uint64_t totalSize;
+    bool scanned;
+
+public:
+    std::atomic<uint64_t> hits, misses, evictions;
+
+    ResultCache() : capacity(0), verify(false), totalSize(0), scanned(false), hits(0), misses(0), evictions(0) {}
+
+    static ResultCache& global() {
+        static ResultCache cache;
+        return cache;
+    }
+
+    // Keep results in dir, removing the least recently used ones above capacityBytes. With
+    // verifyContents, keys also hash the contents of the files read.
+    bool enable(const string& dir, uint64_t capacityBytes, bool verifyContents) {
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::cerr << "Unable to create cache directory '" << dir << "'.\n";
+            return false;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        directory = dir;
+        capacity = capacityBytes;
+        verify = verifyContents;
+        entries.clear();
+        scanned = false;
+        return true;
+    }
+
+    bool isEnabled() const {
+        return !directory.empty();
+    }
+
+    // Key of a step's result; empty when the step is not cached (it is not pure, reads
+    // the output of other steps or reads no files) or a file it reads is missing
+    template <typename S>
+    string key(const S& step) const {
+        vector<string> files = step.filesRead();
+        if (!isEnabled() || !step.isPure() || !step.getInputs().empty() || files.empty()) {
+            return "";
+        }
+
+        string text = step.kindName();
+        for (const string& field : step.fields()) {
+            text += '\0' + field;
+        }
+        for (const string& file : files) {
+            string identity = fileFingerprint(file);
+            if (identity == "missing") {
+                return "";
+            }
+            text += '\0' + file + '\0' + identity;
+            if (verify) {
+                text += ':' + to_string(contentHash(file));
+            }
+        }
+        return text;
+    }
+
+    // The saved result for key, if there is one
+    bool lookup(const string& key, string& result) {
+        string path = entryPath(key);
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            ++misses;
+            return false;
+        }
+
+        string data(info.st_size, '\0');
+        bool ok = pread(fd, &data[0], data.size(), 0) == (ssize_t)data.size();
+        threadCounters.bytesRead += data.size();
+        futimens(fd, nullptr);
+        close(fd);
+
+        uint32_t keySize = 0;
+        ok = ok && data.size() >= 12 && memcmp(data.data(), "FLOWRC1", 8) == 0;
+        if (ok) {
+            memcpy(&keySize, data.data() + 8, 4);
+        }
+        ok = ok && data.size() - 12 >= keySize && data.compare(12, keySize, key) == 0;
+        if (!ok) {
+            ++misses;
+            return false;
+        }
+
+        result.assign(data, 12 + keySize, string::npos);
+        ++hits;
+        return true;
+    }
+
+    void store(const string& key, const string& result) {
+        string data("FLOWRC1\0", 8);
+        uint32_t keySize = key.size();
+        data.append(reinterpret_cast<const char*>(&keySize), 4);
+        data += key;
+        data += result;
+
+        string path = entryPath(key);
+        string temporary = path + ".tmp." + to_string(getpid()) + "." + to_string(syscall(SYS_gettid));
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0;
+        for (size_t done = 0; ok && done < data.size();) {
+            ssize_t written = write(fd, data.data() + done, data.size() - done);
+            ok = written > 0;
+            done += ok ? written : 0;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return;
+        }
+        threadCounters.bytesWritten += data.size();
+
+        std::lock_guard<std::mutex> guard(lock);
+        string name = path.substr(directory.size() + 1);
+        if (scanned) {
+            auto existing = entries.find(name);
+            totalSize -= existing != entries.end() ? existing->second.size : 0;
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            entries[name] = {data.size(), now};
+            totalSize += data.size();
+        } else {
+            scan();
+        }
+        if (totalSize > capacity) {
+            evict();
+        }
+    }
+
+private:
+    string entryPath(const string& key) const {
+        char name[40];
+        snprintf(name, sizeof(name), "%016llx%016llx.result", (unsigned long long)hash(key, 14695981039346656037ull),
+                 (unsigned long long)hash(key, 0x9e3779b97f4a7c15ull));
+        return directory + "/" + name;
+    }
+
+    static uint64_t hash(string_view text, uint64_t h) {
+        for (char c : text) {
+            h = (h ^ (unsigned char)c) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    // Hash of a whole file, eight bytes at a time
+    static uint64_t contentHash(const string& path) {
+        MappedFile file(path);
+        const char* p = file.data();
+        size_t size = file.isOpen() ? file.size() : 0;
+        uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, p + i, 8);
+            h = ((h << 29 | h >> 35) ^ word) * 0xff51afd7ed558ccdull;
+        }
+        for (; i < size; ++i) {
+            h = (h ^ (unsigned char)p[i]) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    // Read what is in the directory now, including entries other processes wrote
+    void scan() {
+        entries.clear();
+        totalSize = 0;
+        scanned = true;
+
+        DIR* dir = opendir(directory.c_str());
+        if (!dir) {
+            return;
+        }
+        while (struct dirent* entry = readdir(dir)) {
+            string name = entry->d_name;
+            struct stat info;
+            if (name.size() > 7 && name.compare(name.size() - 7, 7, ".result") == 0 &&
+                stat((directory + "/" + name).c_str(), &info) == 0) {
+                entries[name] = {(uint64_t)info.st_size, info.st_mtim};
+                totalSize += info.st_size;
+            }
+        }
+        closedir(dir);
+    }
+
+    // Remove the least recently used entries until the cache is back under 90% of its
+    // cap, so that the next few stores do not each have to evict
+    void evict() {
+        scan();
+        vector<pair<struct timespec, string>> byUse;
+        for (const auto& entry : entries) {
+            byUse.push_back({entry.second.used, entry.first});
+        }
+        sort(byUse.begin(), byUse.end(), [](const auto& a, const auto& b) {
+            return a.first.tv_sec != b.first.tv_sec ? a.first.tv_sec < b.first.tv_sec : a.first.tv_nsec < b.first.tv_nsec;
+        });
+
+        for (const auto& entry : byUse) {
+            if (totalSize <= capacity / 10 * 9) {
+                break;
+            }
+            if (unlink((directory + "/" + entry.second).c_str()) == 0) {
+                ++evictions;
+            }
+            totalSize -= entries[entry.second].size;
+            entries.erase(entry.second);
+        }
+    }
+};
+
+// Scheduling
+
+#ifdef FLOW_COROUTINES
+class EventLoop;
+
+// Coroutine that starts when first awaited (or spawned on an event loop) and resumes the
+// coroutine awaiting it once it finishes
+class FlowTask {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(Handle finished) noexcept;
+
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+        EventLoop* detachedOn = nullptr;
+        std::exception_ptr error;
+
+        FlowTask get_return_object() {
+            return FlowTask(Handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            error = std::current_exception();
+        }
+    };
+
+private:
+    Handle coroutine;
+
+public:
+    explicit FlowTask(Handle h) : coroutine(h) {}
+
+    FlowTask(FlowTask&& other) noexcept : coroutine(std::exchange(other.coroutine, nullptr)) {}
+
+    FlowTask& operator=(FlowTask&& other) noexcept {
+        std::swap(coroutine, other.coroutine);
+        return *this;
+    }
+
+    ~FlowTask() {
+        if (coroutine) {
+            coroutine.destroy();
+        }
+    }
+
+    Handle handle() const {
+        return coroutine;
+    }
+
+    bool await_ready() const {
+        return !coroutine || coroutine.done();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+        coroutine.promise().continuation = awaiting;
+        return coroutine;
+    }
+
+    void await_resume() {
+        if (coroutine.promise().error) {
+            std::rethrow_exception(coroutine.promise().error);
+        }
+    }
+};
+
+// Runs coroutines on the thread calling run(), one at a time. Work that blocks (file I/O)
+// is awaited through offload(): it runs on the shared thread pool and its coroutine is
+// queued back onto the loop when it is done, so the loop thread never blocks on a file and
+// a single loop can keep any number of flows in flight. Readiness polling (epoll) has no
+// use here, as regular files always poll ready; the pool is what keeps the loop free.
+class EventLoop {
+private:
+    std::mutex lock;
+    std::condition_variable wakeUp;
+    std::deque<std::coroutine_handle<>> ready;
+    vector<FlowTask> spawned;
+    size_t running;
+
+    template <typename Work>
+    struct Offload {
+        EventLoop& loop;
+        Work work;
+
+        bool await_ready() const {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> waiting) {
+            ThreadPool::shared().submit([this, waiting] {
+                work();
+                loop.post(waiting);
+            });
+        }
+
+        void await_resume() {}
+    };
+
+public:
+    EventLoop() : running(0) {}
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Queue a coroutine to be resumed on the loop; safe from any thread
+    void post(std::coroutine_handle<> coroutine) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ready.push_back(coroutine);
+        }
+        wakeUp.notify_one();
+    }
+
+    // Start a task that run() waits for; call from the loop thread
+    void spawn(FlowTask task) {
+        task.handle().promise().detachedOn = this;
+        ++running;
+        post(task.handle());
+        spawned.push_back(std::move(task));
+    }
+
+    template <typename Work>
+    Offload<Work> offload(Work work) {
+        return Offload<Work>{*this, std::move(work)};
+    }
+
+    // Resume queued coroutines until every spawned task has finished
+    void run() {
+        while (running > 0) {
+            std::coroutine_handle<> next;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wakeUp.wait(guard, [this] { return !ready.empty(); });
+                next = ready.front();
+                ready.pop_front();
+            }
+            next.resume();
+        }
+
+        vector<FlowTask> finished;
+        finished.swap(spawned);
+        for (FlowTask& task : finished) {
+            task.await_resume();
+        }
+    }
+
+private:
+    friend struct FlowTask::FinalAwaiter;
+
+    void taskFinished() {
+        --running;
+    }
+};
+
+inline std::coroutine_handle<> FlowTask::FinalAwaiter::await_suspend(Handle finished) noexcept {
+    promise_type& promise = finished.promise();
+    if (promise.detachedOn) {
+        promise.detachedOn->taskFinished();
+    }
+    return promise.continuation ? promise.continuation : std::noop_coroutine();
+}
+#endif
+
+class Flow {
+private:
+    // What the flow remembers about a step between runs
+    struct StepState {
+        bool computed = false;
+        string key;                 // inputs the step last ran with
+        string fingerprint;         // external inputs the step last ran with
+        unsigned long revision = 0; // bumped whenever the step's output changes
+
+        // A step streaming its output, while it runs alongside the step reading it
+        std::thread producer;
+        shared_ptr<ChunkChannel> channel;
+        ostringstream console;      // what it prints, shown once it is done
+    };
+
+    string name;
+    vector<AnyStep> steps;
+    vector<StepState> states;
+    time_t creationTime;
+
+public:
+    Flow(const string& n) : name(n) {
+        creationTime = time(0);  // Current timestamp
+    }
+
+    Flow(const string& n, time_t created) : name(n), creationTime(created) {}
+
+    void addStep(AnyStep step) {
+        steps.push_back(std::move(step));
+        states.push_back(StepState());
+    }
+
+    // Remove the step at the given position; steps after it move up by one
+    void deleteStep(size_t position) {
+        if (position < steps.size()) {
+            steps.erase(steps.begin() + position);
+            states.erase(states.begin() + position);
+        }
+    }
+
+    size_t stepCount() const {
+        return steps.size();
+    }
+
+    StepValue::Kind stepOutputKind(size_t position) const {
+        return std::visit([](const auto& step) { return step.outputKind(); }, steps[position]);
+    }
+
+    // Check that every input refers to an earlier step producing the declared kind of value
+    bool validInputs(const vector<StepInput>& inputs, size_t position) const {
+        for (const StepInput& input : inputs) {
+            if (input.step >= position || stepOutputKind(input.step) != input.kind) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Run the steps in order. A pure step whose inputs and fingerprint are unchanged since
+    // its last run is not recomputed; it replays its remembered result instead.
+    void execute() {
+        MetricsProbe probe(name);
+        for (size_t i = 0; i < steps.size(); ++i) {
+            runStep(i);
+        }
+        finishStreams();
+    }
+
+    // Run steps that share no inputs and no files at the same time on the shared pool.
+    // Console output of every step is buffered and printed in flow order, so it reads
+    // exactly as a sequential run would.
+    void executeParallel() {
+        MetricsProbe probe(name);
+        ThreadPool& pool = ThreadPool::shared();
+        size_t count = steps.size();
+        if (count == 0) {
+            return;
+        }
+
+        vector<vector<size_t>> dependents = dependencyGraph();
+        vector<std::atomic<int>> waitingOn(count);
+        for (size_t i = 0; i < count; ++i) {
+            waitingOn[i] = 0;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t j : dependents[i]) {
+                ++waitingOn[j];
+            }
+        }
+
+        vector<ostringstream> buffers(count);
+        vector<bool> finished(count, false);
+        size_t nextToPrint = 0;
+        size_t finishedCount = 0;
+        std::mutex doneLock;
+        std::condition_variable allDone;
+
+        function<void(size_t)> runTask = [&](size_t i) {
+            if (std::visit([](const auto& step) { return step.isInteractive(); }, steps[i])) {
+                // Only interactive steps talk to the terminal directly; everything before
+                // them has already been printed
+                std::lock_guard<std::mutex> guard(doneLock);
+                printReady(buffers, finished, nextToPrint);
+                runStep(i);
+            } else {
+                stepConsole = &buffers[i];
+                runStep(i);
+                stepConsole = &cout;
+            }
+
+            for (size_t j : dependents[i]) {
+                if (--waitingOn[j] == 0) {
+                    pool.submit([&runTask, j] { runTask(j); });
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(doneLock);
+            finished[i] = true;
+            printReady(buffers, finished, nextToPrint);
+            if (++finishedCount == count) {
+                allDone.notify_all();
+            }
+        };
+
+        // Find every step that is ready before submitting any: once the first one runs,
+        // the counters change under our feet and finished steps submit their dependents
+        vector<size_t> ready;
+        for (size_t i = 0; i < count; ++i) {
+            if (waitingOn[i] == 0) {
+                ready.push_back(i);
+            }
+        }
+        for (size_t i : ready) {
+            pool.submit([&runTask, i] { runTask(i); });
+        }
+
+        std::unique_lock<std::mutex> guard(doneLock);
+        allDone.wait(guard, [&] { return finishedCount == count; });
+        finishStreams();
+    }
+
+#ifdef FLOW_COROUTINES
+    // Run the steps in order as a coroutine on an event loop. Steps that read or write
+    // files, or read a stream and so wait for the step producing it, run on the thread pool
+    // while the flow is suspended; everything else runs on the loop. What a step prints is
+    // buffered and printed whole once it is done, so the output of flows interleaved on one
+    // loop never mixes within a step.
+    FlowTask executeAsync(EventLoop& loop) {
+        ostringstream buffer;
+        for (size_t i = 0; i < steps.size(); ++i) {
+            bool blocking = std::visit([](const auto& step) {
+                vector<StepInput> inputs = step.getInputs();
+                bool readsStream = any_of(inputs.begin(), inputs.end(),
+                                          [](const StepInput& input) { return input.kind == StepValue::STREAM; });
+                return !step.isInteractive() &&
+                       (readsStream || !step.filesRead().empty() || !step.filesWritten().empty());
+            }, steps[i]);
+
+            auto run = [this, &buffer, i] {
+                stepConsole = &buffer;
+                runStep(i);
+                stepConsole = &cout;
+            };
+            if (blocking) {
+                co_await loop.offload(run);
+            } else {
+                run();
+            }
+
+            cout << buffer.str();
+            buffer.str("");
+        }
+        finishStreams();
+        cout.flush();
+    }
+#endif
+
+    // Number of later steps reading the output of the step at position
+    size_t readersOf(size_t position) const {
+        size_t readers = 0;
+        for (size_t j = position + 1; j < steps.size(); ++j) {
+            for (const StepInput& input : std::visit([](const auto& step) { return step.getInputs(); }, steps[j])) {
+                readers += input.step == position;
+            }
+        }
+        return readers;
+    }
+
+    // Position of the latest step streaming under a name, or stepCount() if there is none
+    size_t streamStep(const string& streamName) const {
+        for (size_t i = steps.size(); i-- > 0;) {
+            if (std::visit([](const auto& step) { return step.streamName(); }, steps[i]) == streamName) {
+                return i;
+            }
+        }
+        return steps.size();
+    }
+
+    // Position of the first step whose stream no later step reads, or stepCount()
+    size_t unreadStream() const {
+        for (size_t i = 0; i < steps.size(); ++i) {
+            if (stepOutputKind(i) == StepValue::STREAM && readersOf(i) == 0) {
+                return i;
+            }
+        }
+        return steps.size();
+    }
+
+private:
+    // For every step, the later steps that must wait for it: those reading its output,
+    // those touching a file it writes or writing a file it reads, and anything on the
+    // other side of an interactive step
+    vector<vector<size_t>> dependencyGraph() const {
+        size_t count = steps.size();
+        vector<vector<size_t>> dependents(count);
+
+        // What every step touches, gathered once
+        struct Access {
+            vector<StepInput> inputs;
+            vector<string> reads, writes;
+            bool interactive;
+        };
+        vector<Access> access(count);
+        for (size_t i = 0; i < count; ++i) {
+            std::visit([&](const auto& step) {
+                access[i] = {step.getInputs(), step.filesRead(), step.filesWritten(), step.isInteractive()};
+            }, steps[i]);
+        }
+
+        for (size_t j = 0; j < count; ++j) {
+            for (size_t i = 0; i < j; ++i) {
+                bool depends = access[i].interactive || access[j].interactive;
+
+                for (const StepInput& input : access[j].inputs) {
+                    depends = depends || input.step == i;
+                }
+
+                for (const string& file : access[i].writes) {
+                    depends = depends || contains(access[j].reads, file) || contains(access[j].writes, file);
+                }
+                for (const string& file : access[i].reads) {
+                    depends = depends || contains(access[j].writes, file);
+                }
+
+                if (depends) {
+                    dependents[i].push_back(j);
+                }
+            }
+        }
+        return dependents;
+    }
+
+    static bool contains(const vector<string>& files, const string& file) {
+        return find(files.begin(), files.end(), file) != files.end();
+    }
+
+    static void printReady(vector<ostringstream>& buffers, vector<bool>& finished, size_t& nextToPrint) {
+        while (nextToPrint < buffers.size() && finished[nextToPrint]) {
+            cout << buffers[nextToPrint].str();
+            buffers[nextToPrint].str("");
+            ++nextToPrint;
+        }
+        cout.flush();
+    }
+
+    const StepValue& outputOf(size_t position) const {
+        return std::visit([](const Step& step) -> const StepValue& { return step.getOutput(); }, steps[position]);
+    }
+
+    void runStep(size_t i) {
+        vector<StepInput> inputs;
+        bool streaming = false;
+        std::visit([&](auto& step) {
+            inputs = step.getInputs();
+
+            if (!validInputs(inputs, i)) {
+                std::cerr << "Step " << i << " refers to a missing or incompatible step, skipping.\n";
+                return;
+            }
+
+            vector<const StepValue*> values;
+            string fingerprint = step.inputFingerprint();
+            string key = fingerprint;
+            for (const StepInput& input : inputs) {
+                values.push_back(&outputOf(input.step));
+                key += "|" + to_string(states[input.step].revision);
+            }
+
+            // A stream is produced on a thread of its own while the flow goes on to the step
+            // reading it, which finishes it. Streams it reads itself are finished on that
+            // thread, and what their steps printed follows what it printed.
+            if (step.outputKind() == StepValue::STREAM) {
+                StepState& state = states[i];
+                step.setInputs(values);
+                state.channel = step.getOutput().channel;
+                ++state.revision;
+                state.computed = true;
+                state.key = key;
+                state.fingerprint = fingerprint;
+                state.producer = std::thread([this, &step, &state, i, inputs] {
+                    stepConsole = &state.console;
+                    {
+                        MetricsProbe probe(name, i, step.kindName());
+                        step.execute();
+                    }
+                    state.channel->close();
+
+                    string own = state.console.str();
+                    state.console.str("");
+                    finishStreams(inputs);
+                    state.console << own;
+                    stepConsole = &cout;
+                });
+                streaming = true;
+                if (readersOf(i) == 0) {
+                    finishStream(i);
+                }
+                return;
+            }
+
+            MetricsProbe probe(name, i, step.kindName());
+            StepState& state = states[i];
+            if (step.isPure() && state.computed && state.key == key) {
+                probe.setPhase("replay");
+                step.replay();
+                return;
+            }
+
+            StepValue previous = step.getOutput();
+            step.setInputs(values);
+
+            // Without a result in memory, a result saved on disk by an earlier run will do
+            ResultCache& cache = ResultCache::global();
+            string cacheKey = cache.isEnabled() ? cache.key(step) : "";
+            string saved;
+            if (!cacheKey.empty() && cache.lookup(cacheKey, saved) && step.loadResult(saved)) {
+                probe.setPhase("cache");
+                step.replay();
+            } else {
+                step.execute();
+                saved.clear();
+                if (!cacheKey.empty() && step.saveResult(saved)) {
+                    cache.store(cacheKey, saved);
+                }
+            }
+
+            // A changed input file counts as a new output even if the summary matches
+            if (!state.computed || !(step.getOutput() == previous) || state.fingerprint != fingerprint) {
+                ++state.revision;
+            }
+            state.computed = true;
+            state.key = key;
+            state.fingerprint = fingerprint;
+        }, steps[i]);
+
+        if (!streaming) {
+            finishStreams(inputs);
+        }
+    }
+
+    // Wait for the step producing a stream to be done, cancelling whatever its reader left
+    // unread, and show what it printed
+    void finishStream(size_t i) {
+        StepState& state = states[i];
+        if (!state.producer.joinable()) {
+            return;
+        }
+        state.channel->cancel();
+        state.producer.join();
+        state.channel.reset();
+        console() << state.console.str();
+        state.console.str("");
+    }
+
+    void finishStreams(const vector<StepInput>& inputs) {
+        for (const StepInput& input : inputs) {
+            if (input.kind == StepValue::STREAM) {
+                finishStream(input.step);
+            }
+        }
+    }
+
+    // Streams no step read, at the end of a run. Later streams go first: a stream step
+    // still running finishes the streams it reads itself.
+    void finishStreams() {
+        for (size_t i = steps.size(); i-- > 0;) {
+            finishStream(i);
+        }
+    }
+
+public:
+    void writeOutput(OutputSink& out) {
+        for (size_t i = 0; i < steps.size(); ++i) {
+            std::visit([&](auto& step) {
+                MetricsProbe probe(name, i, step.kindName(), "write");
+                step.writeOutput(out);
+            }, steps[i]);
+        }
+    }
+
+    const string& getName() const {
+        return name;
+    }
+
+    time_t getCreationTime() const {
+        return creationTime;
+    }
+
+    const vector<AnyStep>& getSteps() const {
+        return steps;
+    }
+};
+
+// Flow registry
+//
+// Flows by name, safe to use from any number of threads. Names are hashed over a fixed
+// number of shards, each a hash map behind its own shared_mutex: lookups take their
+// shard's lock shared and do one hash lookup, so they only wait on a writer adding to or
+// removing from the same shard, which is a single O(1) map update. Entries are reference
+// counted, so a flow removed while it runs is freed only once the last runner lets go of
+// its handle.
+class FlowRegistry {
+public:
+    struct Entry {
+        unique_ptr<Flow> flow;
+        unsigned long sequence; // order flows were added in
+        std::mutex runLock;     // held while the flow runs
+    };
+
+    using Handle = shared_ptr<Entry>;
+
+private:
+    static const size_t SHARDS = 64;
+
+    struct Shard {
+        mutable std::shared_mutex lock;
+        unordered_map<string, Handle> flows;
+    };
+
+    array<Shard, SHARDS> shards;
+    std::atomic<unsigned long> nextSequence;
+
+    Shard& shardOf(const string& name) {
+        return shards[std::hash<string>()(name) % SHARDS];
+    }
+
+    const Shard& shardOf(const string& name) const {
+        return shards[std::hash<string>()(name) % SHARDS];
+    }
+
+public:
+    FlowRegistry() : nextSequence(0) {}
+
+    Handle find(const string& name) const {
+        const Shard& shard = shardOf(name);
+        std::shared_lock<std::shared_mutex> guard(shard.lock);
+        auto it = shard.flows.find(name);
+        return it == shard.flows.end() ? nullptr : it->second;
+    }
+
+    // Take ownership of a flow and register it under its name. If the name is taken, the
+    // flow is deleted and the handle of the registered one is returned with added false.
+    Handle add(Flow* flow, bool* added = nullptr) {
+        unique_ptr<Flow> owned(flow);
+        Shard& shard = shardOf(owned->getName());
+        std::unique_lock<std::shared_mutex> guard(shard.lock);
+
+        auto existing = shard.flows.find(owned->getName());
+        if (added) {
+            *added = existing == shard.flows.end();
+        }
+        if (existing != shard.flows.end()) {
+            return existing->second;
+        }
+
+        Handle entry = make_shared<Entry>();
+        entry->flow = std::move(owned);
+        entry->sequence = nextSequence++;
+        shard.flows[entry->flow->getName()] = entry;
+        return entry;
+    }
+
+    bool remove(const string& name) {
+        Shard& shard = shardOf(name);
+        std::unique_lock<std::shared_mutex> guard(shard.lock);
+        return shard.flows.erase(name) > 0;
+    }
+
+    // All flows, in the order they were added. Each shard is read consistently, but a flow
+    // added to one shard while another is being read may or may not be included.
+    vector<Handle> list() const {
+        vector<Handle> flows;
+        for (const Shard& shard : shards) {
+            std::shared_lock<std::shared_mutex> guard(shard.lock);
+            for (const auto& entry : shard.flows) {
+                flows.push_back(entry.second);
+            }
+        }
+        sort(flows.begin(), flows.end(), [](const Handle& a, const Handle& b) { return a->sequence < b->sequence; });
+        return flows;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const Shard& shard : shards) {
+            std::shared_lock<std::shared_mutex> guard(shard.lock);
+            total += shard.flows.size();
+        }
+        return total;
+    }
+};
+
+// Building flows
+
+// Append a step to a flow from its keyword and text arguments, as written in flow files
+// (see loadFlowFile). References to earlier steps are checked against what the flow holds
+// so far. On failure, error says why and the flow is unchanged.
+bool addStepFromFields(Flow* flow, const string& kind, const vector<string>& fields, string& error) {
+    auto expect = [&](size_t count) {
+        if (fields.size() < count) {
+            error = "'" + kind + "' needs " + to_string(count) + " argument(s)";
+            return false;
+        }
+        return true;
+    };
+
+    // A stream has one reader only
+    auto readOnce = [&](size_t position) {
+        if (flow->readersOf(position) > 0) {
+            error = "the stream of step " + to_string(position) + " is already read by another step";
+            return false;
+        }
+        return true;
+    };
+
+    // Position of an earlier step, written as a plain number
+    auto earlierStep = [&](string_view text, size_t& position) {
+        auto parsed = std::from_chars(text.data(), text.data() + text.size(), position);
+        return !text.empty() && parsed.ec == std::errc() && parsed.ptr == text.data() + text.size() &&
+               position < flow->stepCount();
+    };
+
+    if (kind == "title" || kind == "text") {
+        if (!expect(2)) {
+            return false;
+        }
+        if (kind == "title") {
+            flow->addStep(TitleStep(fields[0], fields[1]));
+        } else {
+            flow->addStep(TextStep(fields[0], fields[1]));
+        }
+    } else if (kind == "textinput") {
+        if (!expect(1)) {
+            return false;
+        }
+        flow->addStep(TextInputStep(fields[0]));
+    } else if (kind == "number") {
+        if (!expect(2)) {
+            return false;
+        }
+        char* end;
+        errno = 0;
+        long num = strtol(fields[1].c_str(), &end, 10);
+        if (*end != '\0' || end == fields[1].c_str() || errno == ERANGE || num < INT_MIN || num > INT_MAX) {
+            error = "'" + fields[1] + "' is not a whole number";
+            return false;
+        }
+        flow->addStep(NumberInputStep(fields[0], (int)num));
+    } else if (kind == "calculus") {
+        if (!expect(3)) {
+            return false;
+        }
+        ColumnOperation op;
+        if (fields[2].size() != 1 || !columnOperationFor(fields[2][0], op)) {
+            error = "'" + fields[2] + "' is not an operation (+ - * / m M)";
+            return false;
+        }
+        StepInput operands[2];
+        for (int i = 0; i < 2; i++) {
+            size_t dot = fields[i].find('.');
+            size_t step;
+            bool ok = earlierStep(string_view(fields[i]).substr(0, dot), step);
+            if (ok) {
+                StepValue::Kind available = flow->stepOutputKind(step);
+                operands[i] = {step, available, ""};
+                if (dot != string::npos) {
+                    operands[i].column = fields[i].substr(dot + 1);
+                    ok = available == StepValue::TABLE;
+                } else {
+                    ok = available == StepValue::NUMBER || available == StepValue::COLUMN;
+                }
+            }
+            if (!ok) {
+                error = "operand '" + fields[i] + "' is not an earlier number, column or CSV column";
+                return false;
+            }
+        }
+        flow->addStep(CalculusStep(operands[0], operands[1], fields[2][0]));
+    } else if (kind == "expression") {
+        if (!expect(1)) {
+            return false;
+        }
+        ExpressionStep step(fields[0], [flow](size_t position) {
+            return position < flow->stepCount() ? flow->stepOutputKind(position) : StepValue::NONE;
+        });
+        if (!step.isValid()) {
+            error = step.error();
+            return false;
+        }
+        flow->addStep(std::move(step));
+    } else if (kind == "textfile" || kind == "csvfile") {
+        if (!expect(2)) {
+            return false;
+        }
+        if (kind == "textfile") {
+            flow->addStep(TextFileInputStep(fields[0], fields[1]));
+        } else {
+            flow->addStep(CsvFileInputStep(fields[0], fields[1]));
+        }
+    } else if (kind == "aggregate") {
+        if (!expect(4)) {
+            return false;
+        }
+        size_t step;
+        StepValue::Kind source = earlierStep(fields[0], step) ? flow->stepOutputKind(step) : StepValue::NONE;
+        if (source != StepValue::TABLE && source != StepValue::STREAM) {
+            error = "'" + fields[0] + "' is not an earlier CSV or stream step";
+            return false;
+        }
+        if (source == StepValue::STREAM && !readOnce(step)) {
+            return false;
+        }
+        // Memory budget in MB, up to 1 TB so that it converts to bytes without overflowing
+        size_t memory = 64;
+        if (fields.size() > 4) {
+            auto parsed = std::from_chars(fields[4].data(), fields[4].data() + fields[4].size(), memory);
+            if (parsed.ec != std::errc() || parsed.ptr != fields[4].data() + fields[4].size() || memory == 0 ||
+                memory > (1 << 20)) {
+                error = "'" + fields[4] + "' is not a memory budget in MB";
+                return false;
+            }
+        }
+        flow->addStep(AggregateStep({step, source, ""}, fields[1], fields[2], fields[3], memory));
+    } else if (kind == "lookup") {
+        if (!expect(4)) {
+            return false;
+        }
+        size_t step;
+        if (!earlierStep(fields[0], step) || flow->stepOutputKind(step) != StepValue::TABLE) {
+            error = "'" + fields[0] + "' is not an earlier CSV step";
+            return false;
+        }
+        flow->addStep(LookupStep(step, fields[1], fields[2], fields[3], fields.size() > 4 ? fields[4] : ""));
+    } else if (kind == "display") {
+        if (!expect(1)) {
+            return false;
+        }
+        string fName = fields[0];
+        if (isStreamName(fName)) {
+            size_t step = flow->streamStep(fName);
+            if (step == flow->stepCount()) {
+                error = "'" + fName + "' is not the stream of an earlier step";
+                return false;
+            }
+            if (!readOnce(step)) {
+                return false;
+            }
+            flow->addStep(DisplayStep(fName, step));
+        } else {
+            flow->addStep(DisplayStep(fName));
+        }
+    } else if (kind == "output") {
+        if (!expect(3)) {
+            return false;
+        }
+        OutputStep step(fields[0], fields[1], fields[2], fields.size() > 3 ? fields[3] : "", [flow](size_t position) {
+            return position < flow->stepCount() ? flow->stepOutputKind(position) : StepValue::NONE;
+        });
+        if (!step.isValid()) {
+            error = step.error();
+            return false;
+        }
+        flow->addStep(std::move(step));
+    } else {
+        error = "unknown step '" + kind + "'";
+        return false;
+    }
+    return true;
+}
+
+// Load flows from a text file, one step per line, mirroring the answers given in the
+// interactive builder. A file holds any number of flows, with steps in any order:
+//
+//   flow <name>
+//   title <title> <subtitle>
+//   text <title> <copy>
+//   textinput <description>
+//   number <description> <value>
+//   calculus <operand> <operand> <operation>
+//       (an operand is the 0-based position of an earlier number or column step, or
+//        <position>.<column> for a column of an earlier CSV step; the operation is one of
+//        + - * / m (min) M (max))
+//   expression <formula>                   (e.g. max(s2, s3) * (s4 - 1) / s5.price)
+//   textfile <description> <file name>     (reads <file name>.txt)
+//   csvfile <description> <file name>
+//   aggregate <csv or stream step> <key columns> <value columns> <output name> [memory MB]
+//       (columns are comma-separated, e.g. aggregate 1 region,product price,units sales;
+//        writes <output name>.csv)
+//   lookup <csv step> <key column> <output name> <key> [<last key>]
+//       (the rows whose key equals <key>, or lies from <key> to <last key>, found through
+//        an index kept in <csv file>.<key column>.idx; writes <output name>.csv)
+//   display <file name or @stream>
+//   output <file name> <title> <description> [<information>]
+//       (any of them may hold placeholders: {{s2}} for the result of step 2, {{s1.name}}
+//        for column name of CSV step 1, which renders one report per CSV record, {{row}})
+//   end
+//
+// An output name starting with '@' (aggregate 1 region price @sales) streams the rows to
+// the one later step reading it, display @sales or an aggregate of that step, instead of
+// writing a file.
+//
+// Fields are separated by whitespace; a field holding spaces is written in double quotes,
+// with \" and \\ inside. A formula is the rest of its line. Blank lines and lines starting
+// with '#' are ignored, and the 'end' of the last flow may be left out.
+//
+// The text is parsed in one pass without copying lines, and every step is checked as it
+// is added, so a flow that loads is fully resolved. A flow with an error is dropped and
+// the error recorded against its line; the flows around it still load.
+struct FlowSpecError {
+    size_t line;
+    string message;
+};
+
+void parseFlowSpecs(string_view text, vector<Flow*>& flows, vector<FlowSpecError>& errors) {
+    Flow* flow = nullptr;
+    bool skipping = false; // inside a flow that had an error
+    std::unordered_map<string, bool> names;
+    vector<string> fields;
+    size_t lineNumber = 0;
+
+    auto finish = [&] {
+        size_t unread = flow ? flow->unreadStream() : 0;
+        if (flow && unread < flow->stepCount()) {
+            errors.push_back({lineNumber, "flow '" + flow->getName() + "': the stream of step " + to_string(unread) +
+                                              " is never read"});
+            delete flow;
+        } else if (flow) {
+            flows.push_back(flow);
+        }
+        flow = nullptr;
+        skipping = false;
+    };
+    auto fail = [&](const string& message) {
+        errors.push_back({lineNumber, message});
+        delete flow;
+        flow = nullptr;
+        skipping = true;
+    };
+
+    while (!text.empty()) {
+        size_t newline = text.find('\n');
+        string_view line = text.substr(0, newline);
+        text.remove_prefix(newline == string_view::npos ? text.size() : newline + 1);
+        ++lineNumber;
+
+        size_t p = 0;
+        auto skipSpaces = [&] {
+            while (p < line.size() && isspace((unsigned char)line[p])) {
+                ++p;
+            }
+        };
+        auto word = [&] {
+            size_t start = p;
+            while (p < line.size() && !isspace((unsigned char)line[p])) {
+                ++p;
+            }
+            return line.substr(start, p - start);
+        };
+
+        skipSpaces();
+        string_view kind = word();
+        if (kind.empty() || kind[0] == '#') {
+            continue;
+        }
+
+        if (kind == "flow") {
+            finish();
+            skipSpaces();
+            string_view name = word();
+            if (name.empty()) {
+                fail("missing flow name");
+                continue;
+            }
+            if (!names.emplace(string(name), true).second) {
+                fail("flow '" + string(name) + "' is defined twice");
+                continue;
+            }
+            flow = new Flow(string(name));
+            continue;
+        }
+
+        if (kind == "end") {
+            if (!flow && !skipping) {
+                errors.push_back({lineNumber, "'end' outside a flow"});
+            }
+            finish();
+            continue;
+        }
+
+        if (skipping) {
+            continue;
+        }
+        if (!flow) {
+            errors.push_back({lineNumber, "'" + string(kind) + "' outside a flow"});
+            continue;
+        }
+
+        fields.clear();
+        bool unterminated = false;
+        skipSpaces();
+        if (kind == "expression") {
+            string_view formula = line.substr(p);
+            while (!formula.empty() && isspace((unsigned char)formula.back())) {
+                formula.remove_suffix(1);
+            }
+            if (!formula.empty()) {
+                fields.emplace_back(formula);
+            }
+        }
+        while (kind != "expression" && p < line.size()) {
+            if (line[p] != '"') {
+                fields.emplace_back(word());
+                skipSpaces();
+                continue;
+            }
+
+            string field;
+            bool closed = false;
+            for (++p; p < line.size() && !closed; ++p) {
+                if (line[p] == '\\' && p + 1 < line.size()) {
+                    field += line[++p];
+                } else if (line[p] == '"') {
+                    closed = true;
+                } else {
+                    field += line[p];
+                }
+            }
+            if (!closed) {
+                unterminated = true;
+                break;
+            }
+            fields.push_back(std::move(field));
+            skipSpaces();
+        }
+        if (unterminated) {
+            fail("flow '" + flow->getName() + "': unterminated quoted field");
+            continue;
+        }
+
+        string error;
+        if (!addStepFromFields(flow, string(kind), fields, error)) {
+            fail("flow '" + flow->getName() + "': " + error);
+        }
+    }
+    finish();
+}
+
+// Load every valid flow in a flow file and print the errors of the others. Returns false if
+// the file cannot be read or any of its flows has an error; the valid flows are added to
+// flows either way, so the caller decides whether to keep them.
+bool loadFlowFiles(const string& path, vector<Flow*>& flows) {
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        std::cerr << "Unable to open flow file '" << path << "'.\n";
+        return false;
+    }
+
+    vector<Flow*> loaded;
+    vector<FlowSpecError> errors;
+    parseFlowSpecs(string_view(file.data(), file.size()), loaded, errors);
+    if (loaded.empty() && errors.empty()) {
+        errors.push_back({0, "missing 'flow <name>' line"});
+    }
+
+    for (const FlowSpecError& error : errors) {
+        std::cerr << path << ":" << error.line << ": " << error.message << ".\n";
+    }
+    flows.insert(flows.end(), loaded.begin(), loaded.end());
+    return errors.empty();
+}
+
+// Load the flow of a flow file that holds exactly one
+Flow* loadFlowFile(const string& path) {
+    vector<Flow*> flows;
+    bool ok = loadFlowFiles(path, flows);
+    if (!ok || flows.size() != 1) {
+        if (ok) {
+            std::cerr << path << ": holds " << flows.size() << " flows, expected one.\n";
+        }
+        for (Flow* flow : flows) {
+            delete flow;
+        }
+        return nullptr;
+    }
+    return flows[0];
+}
+
+// flow_project check <flow file>...
+// Load and validate every flow of every file, the files spread over all cores, and print
+// each error with its file and line. Nothing runs. Exits with 1 if any flow is invalid.
+int checkFlowFiles(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " check <flow file>...\n";
+        return 1;
+    }
+
+    struct Result {
+        bool opened = false;
+        size_t flows = 0;
+        vector<FlowSpecError> errors;
+    };
+    vector<Result> results(argc - 2);
+
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool::shared().forEach(results.size(), [&](size_t i) {
+        MappedFile file(argv[i + 2]);
+        results[i].opened = file.isOpen();
+        if (!file.isOpen()) {
+            return;
+        }
+        vector<Flow*> flows;
+        parseFlowSpecs(string_view(file.data(), file.size()), flows, results[i].errors);
+        results[i].flows = flows.size();
+        for (Flow* flow : flows) {
+            delete flow;
+        }
+    });
+    auto end = std::chrono::steady_clock::now();
+
+    size_t valid = 0, errors = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].opened) {
+            std::cerr << "Unable to open flow file '" << argv[i + 2] << "'.\n";
+            ++errors;
+            continue;
+        }
+        for (const FlowSpecError& error : results[i].errors) {
+            std::cerr << argv[i + 2] << ":" << error.line << ": " << error.message << ".\n";
+        }
+        valid += results[i].flows;
+        errors += results[i].errors.size();
+    }
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cerr << valid << " valid flows in " << results.size() << " file(s), " << errors << " error(s), "
+              << (long long)(seconds * 1e3) << " ms (" << (long long)(seconds > 0 ? valid / seconds : 0)
+              << " flows/s)\n";
+    return errors ? 1 : 0;
+}
+
+// Flow catalog
+//
+// Binary file holding any number of flows, loaded with mmap. Opening a catalog only maps
+// it and checks the header, whatever the number of flows; a flow's steps are decoded when
+// the flow is asked for, and names are read in place. Integers are stored in native byte
+// order, so catalogs are meant for the machine that wrote them.
+//
+//   header   "FLOWCAT1", u32 flow count, u32 bucket count, u64 index offset, u64 file size
+//   records  u32 record size, u32 name size, name, i64 creation time, u32 step count, then
+//            per step: u8 kind size, kind, u8 field count, and per field u32 size, bytes
+//   index    bucket count (a power of two) u64 record offsets, 0 for an empty bucket,
+//            open addressing on the FNV-1a hash of the name
+class FlowCatalog {
+private:
+    static const size_t HEADER_SIZE = 32;
+
+    unique_ptr<MappedFile> file;
+    uint32_t flowCount;
+    uint32_t bucketCount;
+    uint64_t indexOffset;
+
+public:
+    FlowCatalog() : flowCount(0), bucketCount(0), indexOffset(0) {}
+
+    // Map a catalog; false if it is missing or not a valid catalog
+    bool open(const string& path) {
+        unique_ptr<MappedFile> mapped(new MappedFile(path, false));
+        if (!mapped->isOpen() || mapped->size() < HEADER_SIZE || memcmp(mapped->data(), "FLOWCAT1", 8) != 0) {
+            return false;
+        }
+
+        uint32_t flows = read32(mapped->data() + 8), buckets = read32(mapped->data() + 12);
+        uint64_t index = read64(mapped->data() + 16), size = read64(mapped->data() + 24);
+        if (size != mapped->size() || index > size || (size - index) / 8 < buckets ||
+            (buckets & (buckets - 1)) != 0 || flows > buckets) {
+            std::cerr << "Flow catalog '" << path << "' is damaged.\n";
+            return false;
+        }
+
+        file = std::move(mapped);
+        flowCount = flows;
+        bucketCount = buckets;
+        indexOffset = index;
+        return true;
+    }
+
+    size_t size() const {
+        return flowCount;
+    }
+
+    // Names of all flows, pointing into the mapping
+    vector<string_view> names() const {
+        vector<string_view> result;
+        for (uint32_t i = 0; i < bucketCount; ++i) {
+            uint64_t offset = bucket(i);
+            if (offset && validRecord(offset)) {
+                result.push_back(recordName(offset));
+            }
+        }
+        return result;
+    }
+
+    bool contains(string_view name) const {
+        return find(name) != 0;
+    }
+
+    // Build the named flow, or return nullptr if the catalog has no such flow
+    Flow* load(string_view name) const {
+        uint64_t offset = find(name);
+        if (!offset) {
+            return nullptr;
+        }
+
+        // Every read is checked against the end of the record before it is made
+        const char* p = file->data() + offset + 8 + name.size();
+        const char* end = file->data() + offset + read32(file->data() + offset);
+        auto fits = [&p, end](size_t n) {
+            return (size_t)(end - p) >= n;
+        };
+
+        if (!fits(12)) {
+            std::cerr << "Flow '" << name << "' in the catalog is damaged: truncated record.\n";
+            return nullptr;
+        }
+        Flow* flow = new Flow(string(name), (time_t)read64(p));
+        uint32_t stepCount = read32(p + 8);
+        p += 12;
+
+        for (uint32_t i = 0; i < stepCount; ++i) {
+            string error = "truncated record";
+            bool ok = fits(1) && fits(2 + (unsigned char)p[0]);
+            string kind;
+            vector<string> fields;
+            if (ok) {
+                kind.assign(p + 1, (unsigned char)p[0]);
+                p += 1 + kind.size();
+                fields.resize((unsigned char)*p++);
+            }
+            for (size_t f = 0; ok && f < fields.size(); ++f) {
+                ok = fits(4) && fits(4 + (size_t)read32(p));
+                if (ok) {
+                    uint32_t length = read32(p);
+                    fields[f].assign(p + 4, length);
+                    p += 4 + length;
+                }
+            }
+
+            if (!ok || !addStepFromFields(flow, kind, fields, error)) {
+                std::cerr << "Flow '" << name << "' in the catalog is damaged: " << error << ".\n";
+                delete flow;
+                return nullptr;
+            }
+        }
+        return flow;
+    }
+
+    // Write the given flows, plus every flow of 'previous' whose name is neither among them
+    // nor in dropped, to a new catalog that atomically replaces path. Flows carried over
+    // from 'previous' are copied as raw records without being decoded.
+    static bool save(const string& path, const vector<const Flow*>& flows, const FlowCatalog* previous = nullptr,
+                     const vector<string>& dropped = {}) {
+        string data(HEADER_SIZE, '\0');
+        vector<uint64_t> records; // offset of every record
+        map<string, bool> written;
+
+        for (const Flow* flow : flows) {
+            const Flow& source = *flow;
+            string name = source.getName();
+            if (written.count(name)) {
+                continue;
+            }
+            written[name] = true;
+
+            uint64_t offset = data.size();
+            append32(data, 0);
+            append32(data, name.size());
+            data += name;
+            append64(data, (uint64_t)source.getCreationTime());
+            append32(data, source.stepCount());
+            for (const AnyStep& step : source.getSteps()) {
+                std::visit([&data](const auto& concrete) {
+                    string kind = concrete.kindName();
+                    vector<string> fields = concrete.fields();
+                    data += (char)kind.size();
+                    data += kind;
+                    data += (char)fields.size();
+                    for (const string& field : fields) {
+                        append32(data, field.size());
+                        data += field;
+                    }
+                }, step);
+            }
+            uint32_t recordSize = data.size() - offset;
+            memcpy(&data[offset], &recordSize, 4);
+            records.push_back(offset);
+        }
+
+        for (const string& name : dropped) {
+            written[name] = true;
+        }
+        if (previous && previous->file) {
+            for (uint32_t i = 0; i < previous->bucketCount; ++i) {
+                uint64_t offset = previous->bucket(i);
+                if (!offset || !previous->validRecord(offset) || written.count(string(previous->recordName(offset)))) {
+                    continue;
+                }
+                records.push_back(data.size());
+                data.append(previous->file->data() + offset, read32(previous->file->data() + offset));
+            }
+        }
+
+        // Index with at most half the buckets in use
+        uint32_t buckets = 1;
+        while (buckets < records.size() * 2) {
+            buckets *= 2;
+        }
+        vector<uint64_t> index(buckets, 0);
+        for (uint64_t record : records) {
+            string_view name(data.data() + record + 8, read32(data.data() + record + 4));
+            uint32_t slot = hash(name) & (buckets - 1);
+            while (index[slot]) {
+                slot = (slot + 1) & (buckets - 1);
+            }
+            index[slot] = record;
+        }
+
+        uint64_t indexStart = data.size();
+        for (uint64_t offset : index) {
+            append64(data, offset);
+        }
+
+        memcpy(&data[0], "FLOWCAT1", 8);
+        uint32_t count = records.size();
+        uint64_t size = data.size();
+        memcpy(&data[8], &count, 4);
+        memcpy(&data[12], &buckets, 4);
+        memcpy(&data[16], &indexStart, 8);
+        memcpy(&data[24], &size, 8);
+
+        return replaceFile(path, data);
+    }
+
+private:
+    static uint32_t read32(const char* p) {
+        uint32_t value;
+        memcpy(&value, p, 4);
+        return value;
+    }
+
+    static uint64_t read64(const char* p) {
+        uint64_t value;
+        memcpy(&value, p, 8);
+        return value;
+    }
+
+    static void append32(string& data, uint32_t value) {
+        data.append(reinterpret_cast<const char*>(&value), 4);
+    }
+
+    static void append64(string& data, uint64_t value) {
+        data.append(reinterpret_cast<const char*>(&value), 8);
+    }
+
+    static uint64_t hash(string_view name) {
+        uint64_t h = 14695981039346656037ull;
+        for (char c : name) {
+            h = (h ^ (unsigned char)c) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    uint64_t bucket(uint32_t i) const {
+        return read64(file->data() + indexOffset + 8 * (uint64_t)i);
+    }
+
+    // Whether offset points at a record lying wholly before the index, with room for its name
+    bool validRecord(uint64_t offset) const {
+        if (offset < HEADER_SIZE || offset > indexOffset || indexOffset - offset < 8) {
+            return false;
+        }
+        uint32_t recordSize = read32(file->data() + offset);
+        uint32_t nameSize = read32(file->data() + offset + 4);
+        return recordSize >= 8 && recordSize <= indexOffset - offset && nameSize <= recordSize - 8;
+    }
+
+    string_view recordName(uint64_t offset) const {
+        return string_view(file->data() + offset + 8, read32(file->data() + offset + 4));
+    }
+
+    // Offset of the named record, or 0; probes at most every bucket once, so a full or
+    // damaged index cannot loop forever
+    uint64_t find(string_view name) const {
+        if (!file || bucketCount == 0) {
+            return 0;
+        }
+        uint32_t slot = hash(name) & (bucketCount - 1);
+        for (uint32_t probe = 0; probe < bucketCount; ++probe, slot = (slot + 1) & (bucketCount - 1)) {
+            uint64_t offset = bucket(slot);
+            if (!offset) {
+                return 0;
+            }
+            if (validRecord(offset) && recordName(offset) == name) {
+                return offset;
+            }
+        }
+        return 0;
+    }
+
+    // Write to a temporary file next to path, sync it and rename it over path, so readers
+    // see either the old catalog or the new one
+    static bool replaceFile(const string& path, const string& data) {
+        string temporary = path + ".tmp." + to_string(getpid());
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0;
+
+        for (size_t done = 0; ok && done < data.size();) {
+            ssize_t written = write(fd, data.data() + done, data.size() - done);
+            ok = written > 0;
+            done += ok ? written : 0;
+        }
+        ok = ok && fsync(fd) == 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+        ok = ok && rename(temporary.c_str(), path.c_str()) == 0;
+
+        if (!ok) {
+            std::cerr << "Unable to write flow catalog '" << path << "'.\n";
+            unlink(temporary.c_str());
+        }
+        return ok;
+    }
+};
+
+// Headless execution
+
+// Run one flow and return how long it took, in microseconds
+long long timedExecute(Flow* flow, bool parallel = false) {
+    auto start = std::chrono::steady_clock::now();
+    if (parallel) {
+        flow->executeParallel();
+    } else {
+        flow->execute();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+#ifdef FLOW_COROUTINES
+// Run a flow repeat times on an event loop and store how long that took, in microseconds
+FlowTask timedExecuteAsync(Flow* flow, int repeat, EventLoop& loop, long long& elapsed) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+        co_await flow->executeAsync(loop);
+    }
+    auto end = std::chrono::steady_clock::now();
+    elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+#endif
+
+// Write the metrics gathered so far as Prometheus text or as a Chrome trace
+bool writeMetrics(const string& path, bool trace) {
+    OutputSink out(path);
+    if (trace) {
+        FlowMetrics::global().writeTrace(out);
+    } else {
+        FlowMetrics::global().writePrometheus(out);
+    }
+    out.flush();
+    return out.isOpen();
+}
+
+// Parse a count given on the command line, such as --repeat N; false unless it is a
+// whole number of at least 1
+bool parseCount(const char* text, int& count) {
+    string_view digits(text);
+    int value = 0;
+    auto parsed = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+    if (digits.empty() || parsed.ec != std::errc() || parsed.ptr != digits.data() + digits.size() || value < 1) {
+        std::cerr << "Expected a positive count, got '" << text << "'.\n";
+        return false;
+    }
+    count = value;
+    return true;
+}
+
+// Options choosing where text input steps get their answers (see InputProvider):
+// --replay FILE, --generate SEED and --record FILE. Returns false when argv[i] is not one
+// of them; ok turns false when it is one that cannot be applied.
+bool parseInputOption(int argc, char* argv[], int& i, bool& ok) {
+    InputProvider& input = InputProvider::global();
+    if (i + 1 >= argc) {
+        return false;
+    }
+    if (strcmp(argv[i], "--replay") == 0) {
+        ok = ok && input.replayFrom(argv[++i]);
+    } else if (strcmp(argv[i], "--generate") == 0) {
+        input.generateFrom(strtoull(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--record") == 0) {
+        ok = ok && input.recordTo(argv[++i]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// flow_project run [--repeat N] [--parallel | --async] [--report FILE] [--catalog FILE]
+//                  [--metrics FILE] [--trace FILE] [--cache DIR [--cache-size MB] [--cache-verify]]
+//                  [--replay FILE | --generate SEED] [--record FILE] <flow>...
+// Each flow is a flow file, or with --catalog, the name of a flow in the catalog. With
+// --async, all the flows run at once as coroutines on one event loop. With --metrics or
+// --trace, the runs are measured and the results written to FILE at the end. With
+// --cache, results of file-backed steps are kept in DIR for later runs (see ResultCache).
+int runBatch(int argc, char* argv[]) {
+    int repeat = 1;
+    bool parallel = false;
+    bool async = false;
+    string reportFile, metricsFile, traceFile, cacheDirectory;
+    uint64_t cacheSize = 256;
+    bool cacheVerify = false;
+    FlowCatalog catalog;
+    vector<Flow*> flows;
+    bool inputOk = true;
+
+    for (int i = 2; i < argc; ++i) {
+        if (parseInputOption(argc, argv, i, inputOk)) {
+            continue;
+        }
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            inputOk = parseCount(argv[++i], repeat) && inputOk;
+            continue;
+        }
+        if (strcmp(argv[i], "--parallel") == 0) {
+            parallel = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--async") == 0) {
+            async = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportFile = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsFile = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceFile = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cacheDirectory = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            cacheSize = strtoull(argv[++i], nullptr, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "--cache-verify") == 0) {
+            cacheVerify = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--catalog") == 0 && i + 1 < argc) {
+            if (!catalog.open(argv[++i])) {
+                std::cerr << "Unable to open flow catalog '" << argv[i] << "'.\n";
+                return 1;
+            }
+            continue;
+        }
+
+        Flow* flow = catalog.contains(argv[i]) ? catalog.load(argv[i]) : nullptr;
+        if (flow) {
+            flows.push_back(flow);
+        } else if (catalog.contains(argv[i]) || !loadFlowFiles(argv[i], flows)) {
+            for (Flow* loaded : flows) {
+                delete loaded;
+            }
+            return 1;
+        }
+    }
+
+    if (flows.empty()) {
+        std::cerr << "Usage: " << argv[0] << " run [--repeat N] [--parallel | --async] [--report FILE] [--catalog FILE]"
+                     " [--metrics FILE] [--trace FILE] [--cache DIR [--cache-size MB] [--cache-verify]]"
+                     " [--replay FILE | --generate SEED] [--record FILE] <flow>...\n";
+        return 1;
+    }
+    if (!inputOk) {
+        for (Flow* flow : flows) {
+            delete flow;
+        }
+        return 1;
+    }
+
+    FlowMetrics::global().enable(!metricsFile.empty() || !traceFile.empty());
+    ResultCache& cache = ResultCache::global();
+    if (!cacheDirectory.empty() && !cache.enable(cacheDirectory, cacheSize << 20, cacheVerify)) {
+        for (Flow* flow : flows) {
+            delete flow;
+        }
+        return 1;
+    }
+
+    // Reports are written by a background thread while the next flow runs
+    unique_ptr<OutputSink> report;
+    if (!reportFile.empty()) {
+        report.reset(new OutputSink(reportFile, true));
+    }
+
+    vector<long long> totals(flows.size(), 0);
+    if (async) {
+#ifdef FLOW_COROUTINES
+        EventLoop loop;
+        for (size_t f = 0; f < flows.size(); ++f) {
+            loop.spawn(timedExecuteAsync(flows[f], repeat, loop, totals[f]));
+        }
+        loop.run();
+#else
+        std::cerr << "Built without coroutine support, running flows one after another.\n";
+        async = false;
+#endif
+    }
+
+    for (size_t f = 0; f < flows.size(); ++f) {
+        Flow* flow = flows[f];
+        long long total = totals[f];
+        for (int r = 0; !async && r < repeat; ++r) {
+            total += timedExecute(flow, parallel);
+        }
+        std::cerr << "flow '" << flow->getName() << "': " << repeat << " run(s), "
+                  << (repeat > 0 ? total / repeat : 0) << " us average\n";
+
+        if (report) {
+            flow->writeOutput(*report);
+        }
+    }
+
+    for (Flow* flow : flows) {
+        delete flow;
+    }
+
+    if (cache.isEnabled()) {
+        std::cerr << "result cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions
+                  << " evictions\n";
+    }
+
+    bool written = (metricsFile.empty() || writeMetrics(metricsFile, false)) &&
+                   (traceFile.empty() || writeMetrics(traceFile, true));
+    return written ? 0 : 1;
+}
+
+// flow_project catalog <catalog file> <flow file>...
+// Add flow files to a catalog, creating it if needed; a flow replaces one of the same name.
+int updateCatalog(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " catalog <catalog file> <flow file>...\n";
+        return 1;
+    }
+
+    FlowCatalog previous;
+    previous.open(argv[2]);
+
+    vector<const Flow*> flows;
+    bool ok = true;
+    for (int i = 3; i < argc && ok; ++i) {
+        vector<Flow*> loaded;
+        ok = loadFlowFiles(argv[i], loaded);
+        flows.insert(flows.end(), loaded.begin(), loaded.end());
+    }
+
+    ok = ok && FlowCatalog::save(argv[2], flows, &previous);
+    for (const Flow* flow : flows) {
+        delete flow;
+    }
+    return ok ? 0 : 1;
+}
+
+// Dataset runs
+//
+// Runs the numeric part of a flow once for every row of a CSV file. Number steps are bound
+// to columns, either explicitly or because their description is a column name; unbound
+// ones keep their number. Every calculus and expression step computing numbers from them
+// adds a result column to a copy of the file. Rows are read in batches small enough to
+// stay in cache and each step runs once per batch through the column kernels, so a step
+// is dispatched once per batch instead of once per row. Other steps are not run.
+class DatasetRun {
+private:
+    // Where the values of a step come from in every batch
+    struct Slot {
+        enum Source { NONE, CONSTANT, FIELD, RESULT };
+
+        Source source = NONE;
+        double constant = 0;
+        size_t index = 0; // FIELD: bound field, RESULT: result column
+    };
+
+    const Flow& flow;
+    size_t batchRows;
+    vector<Slot> slots;
+    vector<size_t> fields;       // CSV field of every bound column
+    vector<size_t> resultSteps;  // step computing every result column
+    vector<string> resultNames;
+    string errorMessage;
+
+    // One batch: bound fields and results, column after column, batchRows values each
+    vector<double> fieldValues, resultValues;
+    vector<vector<const double*>> resultInputs;
+    vector<vector<bool>> resultSingle;
+
+public:
+    DatasetRun(const Flow& f, size_t rows = 1024) : flow(f), batchRows(std::max<size_t>(rows, 1)) {}
+
+    const string& error() const {
+        return errorMessage;
+    }
+
+    // Decide what every step reads and computes. bindings maps number steps to columns,
+    // names gives result columns other names than sN.
+    bool plan(const vector<string>& header, const map<size_t, string>& bindings,
+              const map<size_t, string>& names) {
+        const vector<AnyStep>& steps = flow.getSteps();
+        slots.assign(steps.size(), Slot());
+        fields.clear();
+        resultSteps.clear();
+        resultNames.clear();
+
+        for (const auto& binding : bindings) {
+            if (binding.first >= steps.size() || !std::holds_alternative<NumberInputStep>(steps[binding.first])) {
+                return fail("step " + to_string(binding.first) + " is not a number step");
+            }
+        }
+
+        for (size_t i = 0; i < steps.size(); ++i) {
+            Slot& slot = slots[i];
+            if (const NumberInputStep* number = std::get_if<NumberInputStep>(&steps[i])) {
+                auto bound = bindings.find(i);
+                string column = bound != bindings.end() ? bound->second : number->fields()[0];
+                size_t field = find(header.begin(), header.end(), column) - header.begin();
+                if (field < header.size()) {
+                    slot.source = Slot::FIELD;
+                    slot.index = fields.size();
+                    fields.push_back(field);
+                } else if (bound != bindings.end()) {
+                    return fail("column '" + column + "' not found");
+                } else {
+                    slot.source = Slot::CONSTANT;
+                    slot.constant = number->getOutput().number;
+                }
+                continue;
+            }
+
+            bool computes = std::visit([&](const auto& step) {
+                if (step.outputKind() != StepValue::NUMBER) {
+                    return false;
+                }
+                vector<StepInput> inputs = step.getInputs();
+                for (const StepInput& input : inputs) {
+                    if (input.step >= i || slots[input.step].source == Slot::NONE) {
+                        return false;
+                    }
+                }
+                return step.evaluateRows(vector<const double*>(inputs.size()), vector<bool>(inputs.size()), 0,
+                                         nullptr);
+            }, steps[i]);
+            if (computes) {
+                slot.source = Slot::RESULT;
+                slot.index = resultSteps.size();
+                resultSteps.push_back(i);
+                auto named = names.find(i);
+                resultNames.push_back(named != names.end() ? named->second : "s" + to_string(i));
+            }
+        }
+
+        for (const auto& name : names) {
+            if (name.first >= slots.size() || slots[name.first].source != Slot::RESULT) {
+                return fail("step " + to_string(name.first) + " does not compute a number per row");
+            }
+        }
+        if (resultSteps.empty()) {
+            return fail("the flow computes nothing from its number steps");
+        }
+
+        // Point every input at its place in the batch buffers, which never move
+        fieldValues.assign(fields.size() * batchRows, 0);
+        resultValues.assign(resultSteps.size() * batchRows, 0);
+        resultInputs.assign(resultSteps.size(), {});
+        resultSingle.assign(resultSteps.size(), {});
+        for (size_t r = 0; r < resultSteps.size(); ++r) {
+            vector<StepInput> inputs = std::visit([](const auto& step) { return step.getInputs(); },
+                                                  steps[resultSteps[r]]);
+            for (const StepInput& input : inputs) {
+                const Slot& source = slots[input.step];
+                resultSingle[r].push_back(source.source == Slot::CONSTANT);
+                resultInputs[r].push_back(source.source == Slot::CONSTANT ? &source.constant
+                                          : source.source == Slot::FIELD ? &fieldValues[source.index * batchRows]
+                                                                         : &resultValues[source.index * batchRows]);
+            }
+        }
+        return true;
+    }
+
+    // Copy dataFile to outFile with the result columns added; errors (such as a division
+    // by zero) leave the field empty. Returns false if the run could not be done at all.
+    bool run(const string& dataFile, const string& outFile, const map<size_t, string>& bindings,
+             const map<size_t, string>& names) {
+        CsvReader reader(dataFile);
+        if (!reader.isOpen() || !reader.nextRow()) {
+            return fail("unable to read CSV file '" + dataFile + "'");
+        }
+        vector<string> header(reader.fields().begin(), reader.fields().end());
+        if (!plan(header, bindings, names)) {
+            return false;
+        }
+
+        OutputSink out(outFile);
+        out << reader.rowText();
+        for (const string& name : resultNames) {
+            out << ',' << name;
+        }
+        out << '\n';
+
+        const vector<AnyStep>& steps = flow.getSteps();
+        vector<string_view> rows(batchRows);
+        size_t rowCount = 0, errors = 0;
+        bool more = true;
+
+        while (more) {
+            size_t n = 0;
+            while (n < batchRows && (more = reader.nextRow())) {
+                const vector<string_view>& row = reader.fields();
+                for (size_t c = 0; c < fields.size(); ++c) {
+                    fieldValues[c * batchRows + n] = fields[c] < row.size()
+                                                         ? CsvReader::parseNumber(row[fields[c]])
+                                                         : std::numeric_limits<double>::quiet_NaN();
+                }
+                rows[n++] = reader.rowText();
+            }
+
+            for (size_t r = 0; r < resultSteps.size(); ++r) {
+                double* results = &resultValues[r * batchRows];
+                std::visit([&](const auto& step) { step.evaluateRows(resultInputs[r], resultSingle[r], n, results); },
+                           steps[resultSteps[r]]);
+                errors += columnErrors(results, n);
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                out << rows[i];
+                for (size_t r = 0; r < resultSteps.size(); ++r) {
+                    double value = resultValues[r * batchRows + i];
+                    char number[32];
+                    out << ',';
+                    if (!std::isnan(value)) {
+                        out << string_view(number, std::to_chars(number, number + sizeof(number), value).ptr - number);
+                    }
+                }
+                out << '\n';
+            }
+            rowCount += n;
+        }
+
+        out.flush();
+        if (!out.isOpen()) {
+            return fail("unable to write '" + outFile + "'");
+        }
+        console() << "Dataset '" << dataFile << "': " << rowCount << " rows, " << resultSteps.size()
+                  << " result column(s), " << errors << " errors, written to '" << outFile << "'.\n";
+        return true;
+    }
+
+private:
+    bool fail(const string& message) {
+        errorMessage = message;
+        return false;
+    }
+};
+
+// flow_project dataset [--catalog FILE] [--bind STEP=COLUMN]... [--name STEP=COLUMN]...
+//                      [--batch ROWS] <flow> <data.csv> <out.csv>
+// Run a flow over every row of a CSV file (see DatasetRun)
+int runDataset(int argc, char* argv[]) {
+    FlowCatalog catalog;
+    map<size_t, string> bindings, names;
+    size_t batch = 1024;
+    vector<string> arguments;
+
+    for (int i = 2; i < argc; ++i) {
+        bool bind = strcmp(argv[i], "--bind") == 0;
+        if ((bind || strcmp(argv[i], "--name") == 0) && i + 1 < argc) {
+            string pair = argv[++i];
+            size_t equals = pair.find('='), step = 0;
+            auto parsed = std::from_chars(pair.data(), pair.data() + (equals == string::npos ? 0 : equals), step);
+            if (equals == string::npos || equals == 0 || parsed.ec != std::errc() || parsed.ptr != pair.data() + equals) {
+                std::cerr << "Expected STEP=COLUMN, got '" << pair << "'.\n";
+                return 1;
+            }
+            (bind ? bindings : names)[step] = pair.substr(equals + 1);
+            continue;
+        }
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            string_view text = argv[++i];
+            auto parsed = std::from_chars(text.data(), text.data() + text.size(), batch);
+            if (text.empty() || parsed.ec != std::errc() || parsed.ptr != text.data() + text.size() || batch == 0) {
+                std::cerr << "Expected a positive batch size, got '" << text << "'.\n";
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--catalog") == 0 && i + 1 < argc) {
+            if (!catalog.open(argv[++i])) {
+                std::cerr << "Unable to open flow catalog '" << argv[i] << "'.\n";
+                return 1;
+            }
+            continue;
+        }
+        arguments.push_back(argv[i]);
+    }
+
+    if (arguments.size() != 3) {
+        std::cerr << "Usage: " << argv[0] << " dataset [--catalog FILE] [--bind STEP=COLUMN]... [--name STEP=COLUMN]..."
+                     " [--batch ROWS] <flow> <data.csv> <out.csv>\n";
+        return 1;
+    }
+
+    unique_ptr<Flow> flow(catalog.contains(arguments[0]) ? catalog.load(arguments[0]) : loadFlowFile(arguments[0]));
+    if (!flow) {
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    DatasetRun dataset(*flow, batch);
+    if (!dataset.run(arguments[1], arguments[2], bindings, names)) {
+        std::cerr << "flow '" << flow->getName() << "': " << dataset.error() << ".\n";
+        return 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cerr << "flow '" << flow->getName() << "': "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us\n";
+    return 0;
+}
+
+// Process sharding
+//
+// Runs flows in worker processes forked by a supervisor, so that a step that crashes takes
+// down one worker instead of everything, and flows scale across cores without sharing a
+// heap. Runs of flows go to the workers through a lock-free ring in shared memory and
+// their results come back through another. Workers are pinned to cores. A worker that
+// dies is replaced and the run it was busy with is queued again, unless that run has
+// already killed MAX_ATTEMPTS workers; it is then reported as crashed.
+
+// Bounded multi-producer, multi-consumer queue in memory shared between processes, after
+// Vyukov: the sequence number of every cell tells whether it is free to push into or
+// holds a value to pop, so either side claims a cell with one CAS and neither ever waits
+// for a lock another process might be holding
+template <typename T, size_t CAPACITY>
+class SharedRing {
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "ring capacity must be a power of two");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared rings need lock-free atomics");
+
+    struct Cell {
+        std::atomic<uint64_t> sequence;
+        T value;
+    };
+
+    alignas(64) std::atomic<uint64_t> head; // next cell to pop
+    alignas(64) std::atomic<uint64_t> tail; // next cell to push
+    alignas(64) Cell cells[CAPACITY];
+
+public:
+    SharedRing() : head(0), tail(0) {
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // False when the ring is full
+    bool push(const T& value) {
+        uint64_t position = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & (CAPACITY - 1)];
+            int64_t lag = (int64_t)(cell.sequence.load(std::memory_order_acquire) - position);
+            if (lag == 0 && tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.value = value;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+            if (lag < 0) {
+                return false;
+            }
+            if (lag > 0) {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // False when the ring is empty
+    bool pop(T& value) {
+        uint64_t position = head.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & (CAPACITY - 1)];
+            int64_t lag = (int64_t)(cell.sequence.load(std::memory_order_acquire) - (position + 1));
+            if (lag == 0 && head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                value = cell.value;
+                cell.sequence.store(position + CAPACITY, std::memory_order_release);
+                return true;
+            }
+            if (lag < 0) {
+                return false;
+            }
+            if (lag > 0) {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+class FlowSupervisor {
+public:
+    static constexpr int MAX_WORKERS = 256;
+    static constexpr int MAX_ATTEMPTS = 3;
+
+private:
+    struct Job {
+        uint32_t id;
+        uint32_t flow;
+    };
+
+    struct Result {
+        uint32_t id;
+        int64_t elapsed; // microseconds
+    };
+
+    // Everything the supervisor and the workers share, in one anonymous shared mapping
+    struct Shared {
+        SharedRing<Job, 1024> jobs;
+        SharedRing<Result, 1024> results;
+        std::atomic<bool> stopping{false};
+        std::atomic<int64_t> running[MAX_WORKERS]; // job a worker is running, or -1
+    };
+
+    const vector<Flow*>& flows;
+    int workerCount;
+    Shared* shared;
+    vector<pid_t> workers;
+    vector<int> cores;
+
+public:
+    FlowSupervisor(const vector<Flow*>& toRun, int count)
+        : flows(toRun), workerCount(std::max(1, std::min(count, MAX_WORKERS))), shared(nullptr) {}
+
+    ~FlowSupervisor() {
+        if (shared) {
+            shared->~Shared();
+            munmap(shared, sizeof(Shared));
+        }
+    }
+
+    // Run every flow repeat times; false if any run crashed every worker it was given to
+    bool run(int repeat) {
+        void* memory = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Unable to map shared memory for workers.\n";
+            return false;
+        }
+        shared = new (memory) Shared();
+        for (auto& running : shared->running) {
+            running = -1;
+        }
+
+        // Cores this process may use, shared out to the workers in turn
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cores.push_back(cpu);
+            }
+        }
+
+        size_t total = flows.size() * std::max(repeat, 0);
+        std::deque<Job> pending;
+        for (size_t id = 0; id < total; ++id) {
+            pending.push_back({(uint32_t)id, (uint32_t)(id % flows.size())});
+        }
+        vector<bool> done(total, false);
+        vector<int> attempts(total, 0);
+        vector<long long> elapsed(flows.size(), 0);
+        vector<int> runs(flows.size(), 0), crashed(flows.size(), 0);
+        size_t completed = 0, restarts = 0, idle = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        cout.flush();
+        workers.assign(workerCount, -1);
+        int live = 0;
+        for (int w = 0; w < workerCount; ++w) {
+            live += spawn(w);
+        }
+
+        auto finish = [&](uint32_t id) {
+            if (done[id]) {
+                return false;
+            }
+            done[id] = true;
+            ++completed;
+            return true;
+        };
+
+        while (completed < total && live > 0) {
+            bool progress = false;
+
+            while (!pending.empty() && shared->jobs.push(pending.front())) {
+                pending.pop_front();
+                progress = true;
+            }
+
+            Result result;
+            while (shared->results.pop(result)) {
+                if (finish(result.id)) {
+                    elapsed[result.id % flows.size()] += result.elapsed;
+                    ++runs[result.id % flows.size()];
+                }
+                progress = true;
+            }
+
+            // Only our own workers are reaped, never other children of the process
+            for (int w = 0; w < workerCount; ++w) {
+                int status;
+                if (workers[w] <= 0 || waitpid(workers[w], &status, WNOHANG) != workers[w]) {
+                    continue;
+                }
+                workers[w] = -1;
+                --live;
+                int64_t id = shared->running[w].exchange(-1);
+                if (id >= 0 && !done[id]) {
+                    const string& name = flows[id % flows.size()]->getName();
+                    std::cerr << "worker " << w << " died running flow '" << name << "' ("
+                              << (WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "exited") << ").\n";
+                    if (++attempts[id] < MAX_ATTEMPTS) {
+                        pending.push_front({(uint32_t)id, (uint32_t)(id % flows.size())});
+                    } else if (finish(id)) {
+                        ++crashed[id % flows.size()];
+                    }
+                }
+                if (completed < total && spawn(w)) {
+                    ++live;
+                    ++restarts;
+                }
+                progress = true;
+            }
+
+            // A worker can die between taking a job and saying so; when everything has
+            // been quiet for a while with work missing, queue what is missing again
+            idle = progress ? 0 : idle + 1;
+            if (idle > 2000 && pending.empty() && shared->jobs.empty() && allIdle()) {
+                for (size_t id = 0; id < total; ++id) {
+                    if (!done[id]) {
+                        pending.push_back({(uint32_t)id, (uint32_t)(id % flows.size())});
+                    }
+                }
+                idle = 0;
+            }
+            if (!progress) {
+                usleep(50);
+            }
+        }
+
+        shared->stopping = true;
+        for (pid_t worker : workers) {
+            if (worker > 0) {
+                waitpid(worker, nullptr, 0);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        // Without a worker left, the runs still missing cannot be done
+        bool ok = completed == total;
+        if (!ok) {
+            std::cerr << "No worker could be started or restarted; " << total - completed << " run(s) not done.\n";
+        }
+        for (size_t f = 0; f < flows.size(); ++f) {
+            std::cerr << "flow '" << flows[f]->getName() << "': " << runs[f] << " run(s), "
+                      << (runs[f] > 0 ? elapsed[f] / runs[f] : 0) << " us average";
+            if (crashed[f]) {
+                std::cerr << ", " << crashed[f] << " crashed";
+                ok = false;
+            }
+            std::cerr << "\n";
+        }
+        std::cerr << workerCount << " worker(s), " << restarts << " restart(s), "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
+        return ok;
+    }
+
+private:
+    bool allIdle() const {
+        for (int w = 0; w < workerCount; ++w) {
+            if (shared->running[w] >= 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Start worker w, retrying a failed fork a few times; false if it could not be started
+    bool spawn(int w) {
+        int error = 0;
+        for (int attempt = 0; attempt < MAX_ATTEMPTS; ++attempt) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                work(w);
+            }
+            if (pid > 0) {
+                workers[w] = pid;
+                return true;
+            }
+            error = errno;
+            usleep(1000 << attempt);
+        }
+        std::cerr << "Unable to start worker " << w << ": " << strerror(error) << ".\n";
+        workers[w] = -1;
+        return false;
+    }
+
+    // Body of a worker process; never returns
+    [[noreturn]] void work(int w) {
+        if (!cores.empty()) {
+            cpu_set_t core;
+            CPU_ZERO(&core);
+            CPU_SET(cores[w % cores.size()], &core);
+            sched_setaffinity(0, sizeof(core), &core);
+        }
+
+        // What a run prints is written in one piece, so runs in different workers do not
+        // mix within a line
+        ostringstream buffer;
+        stepConsole = &buffer;
+        int backoff = 0;
+        while (!shared->stopping) {
+            Job job;
+            if (!shared->jobs.pop(job)) {
+                backoff < 64 ? (void)sched_yield() : (void)usleep(100);
+                ++backoff;
+                continue;
+            }
+            backoff = 0;
+
+            shared->running[w] = job.id;
+            Result result{job.id, timedExecute(flows[job.flow])};
+            string text = buffer.str();
+            buffer.str("");
+            for (size_t done = 0; done < text.size();) {
+                ssize_t written = write(STDOUT_FILENO, text.data() + done, text.size() - done);
+                done += written > 0 ? written : text.size();
+            }
+            while (!shared->results.push(result)) {
+                usleep(50);
+            }
+            shared->running[w] = -1;
+        }
+        _exit(0);
+    }
+};
+
+// flow_project shard [--workers N] [--repeat N] [--catalog FILE] [--replay FILE | --generate SEED]
+//                    [--record FILE] <flow>...
+// Run flows in N worker processes, one per core by default (see FlowSupervisor). Every
+// worker replays or generates answers from the start of the sequence.
+int runSharded(int argc, char* argv[]) {
+    int workers = std::max(1u, std::thread::hardware_concurrency());
+    int repeat = 1;
+    FlowCatalog catalog;
+    vector<Flow*> flows;
+    auto release = [&] {
+        for (Flow* flow : flows) {
+            delete flow;
+        }
+    };
+
+    bool inputOk = true;
+
+    for (int i = 2; i < argc; ++i) {
+        if (parseInputOption(argc, argv, i, inputOk)) {
+            continue;
+        }
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            inputOk = parseCount(argv[++i], workers) && inputOk;
+            continue;
+        }
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            inputOk = parseCount(argv[++i], repeat) && inputOk;
+            continue;
+        }
+        if (strcmp(argv[i], "--catalog") == 0 && i + 1 < argc) {
+            if (!catalog.open(argv[++i])) {
+                std::cerr << "Unable to open flow catalog '" << argv[i] << "'.\n";
+                release();
+                return 1;
+            }
+            continue;
+        }
+
+        Flow* flow = catalog.contains(argv[i]) ? catalog.load(argv[i]) : nullptr;
+        if (flow) {
+            flows.push_back(flow);
+        } else if (catalog.contains(argv[i]) || !loadFlowFiles(argv[i], flows)) {
+            release();
+            return 1;
+        }
+    }
+
+    if (flows.empty()) {
+        std::cerr << "Usage: " << argv[0] << " shard [--workers N] [--repeat N] [--catalog FILE]"
+                     " [--replay FILE | --generate SEED] [--record FILE] <flow>...\n";
+        return 1;
+    }
+    if (!inputOk) {
+        release();
+        return 1;
+    }
+
+    // Workers have no terminal to ask the user from
+    for (Flow* flow : flows) {
+        for (const AnyStep& step : flow->getSteps()) {
+            if (std::visit([](const auto& s) { return s.isInteractive(); }, step)) {
+                std::cerr << "flow '" << flow->getName() << "' asks for input; give it --replay or --generate.\n";
+                release();
+                return 1;
+            }
+        }
+    }
+
+    FlowSupervisor supervisor(flows, workers);
+    bool ok = supervisor.run(repeat);
+    release();
+    return ok ? 0 : 1;
+}
+
+// Long-running server on a local Unix socket. Each connection sends one command per line
+// and gets one reply line back:
+//
+//   load <flow file>            ->  ok <flow name>...
+//   run <flow name> [parallel]  ->  ok <flow name> <latency>us
+//   list                        ->  ok <flow name>...
+//   delete <flow name>          ->  ok <flow name>
+//   save                        ->  ok <flow count>
+//   metrics on|off|reset        ->  ok
+//   metrics <file>              ->  ok      (Prometheus text)
+//   trace <file>                ->  ok      (Chrome trace_event JSON)
+//   shutdown                    ->  ok
+//
+// Loaded flows stay in memory in a FlowRegistry shared by all connections; runs of the
+// same flow are serialized, runs of different flows proceed concurrently. With a catalog,
+// a flow that is not loaded yet is loaded from it on its first run, and 'save' writes the
+// loaded flows back into the catalog.
+class FlowDaemon {
+private:
+    string socketPath;
+    string catalogPath;
+    FlowCatalog catalog;
+    std::mutex catalogLock;
+    int listenFd;
+    std::atomic<bool> stopping;
+    FlowRegistry flows;
+    std::mutex clientsLock;
+    std::condition_variable clientsDone;
+    vector<int> clientFds; // connections being handled, each by a detached thread
+
+public:
+    FlowDaemon(const string& path, const string& catalogFile = "")
+        : socketPath(path), catalogPath(catalogFile), listenFd(-1), stopping(false) {
+        if (!catalogPath.empty() && catalog.open(catalogPath)) {
+            std::cerr << "Catalog '" << catalogPath << "' has " << catalog.size() << " flows.\n";
+        }
+    }
+
+    int serve() {
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if (listenFd < 0 || socketPath.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Unable to create socket '" << socketPath << "'.\n";
+            return 1;
+        }
+
+        strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(socketPath.c_str());
+
+        if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 128) < 0) {
+            std::cerr << "Unable to listen on socket '" << socketPath << "'.\n";
+            close(listenFd);
+            return 1;
+        }
+
+        std::cerr << "Listening on '" << socketPath << "'.\n";
+
+        // Handlers are detached so a finished one frees its thread right away; shutdown
+        // waits until the list of live connections is empty instead of joining them
+        while (!stopping) {
+            int clientFd = accept(listenFd, nullptr, nullptr);
+            if (clientFd < 0) {
+                // Out of descriptors or memory: wait for connections to finish
+                if (errno != EINTR && !stopping) {
+                    usleep(10000);
+                }
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(clientsLock);
+            try {
+                std::thread(&FlowDaemon::handleClient, this, clientFd).detach();
+                clientFds.push_back(clientFd);
+            } catch (const std::system_error&) {
+                std::cerr << "Unable to start a thread for a connection.\n";
+                close(clientFd);
+            }
+        }
+
+        // Wake up connections still waiting for a command, then wait for them to end
+        {
+            std::unique_lock<std::mutex> guard(clientsLock);
+            for (int fd : clientFds) {
+                ::shutdown(fd, SHUT_RD);
+            }
+            clientsDone.wait(guard, [this] { return clientFds.empty(); });
+        }
+
+        close(listenFd);
+        unlink(socketPath.c_str());
+        return 0;
+    }
+
+private:
+    void handleClient(int fd) {
+        string pending;
+        char buffer[4096];
+        ssize_t n;
+
+        while (!stopping && (n = read(fd, buffer, sizeof(buffer))) > 0) {
+            pending.append(buffer, n);
+
+            size_t newline;
+            while ((newline = pending.find('\n')) != string::npos) {
+                string reply = handleCommand(pending.substr(0, newline)) + "\n";
+                pending.erase(0, newline + 1);
+                if (!sendAll(fd, reply)) {
+                    pending.clear();
+                    n = 0;
+                    break;
+                }
+            }
+            if (n == 0) {
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(clientsLock);
+        for (auto it = clientFds.begin(); it != clientFds.end(); ++it) {
+            if (*it == fd) {
+                clientFds.erase(it);
+                break;
+            }
+        }
+        close(fd);
+        clientsDone.notify_all();
+    }
+
+    // Send a whole reply; false once the client has gone. MSG_NOSIGNAL turns a client that
+    // hung up before reading into EPIPE instead of a SIGPIPE killing the daemon.
+    static bool sendAll(int fd, const string& reply) {
+        for (size_t done = 0; done < reply.size();) {
+            ssize_t sent = send(fd, reply.data() + done, reply.size() - done, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return false;
+            }
+            done += sent;
+        }
+        return true;
+    }
+
+    string handleCommand(const string& line) {
+        std::istringstream fields(line);
+        string command, argument, mode;
+        fields >> command >> argument >> mode;
+
+        if (command == "load") {
+            // The valid flows of a file with errors are still loaded
+            vector<Flow*> loaded;
+            bool valid = loadFlowFiles(argument, loaded);
+            if (!valid && loaded.empty()) {
+                return "error cannot load '" + argument + "'";
+            }
+
+            // Flows already loaded under the same name are kept, the new ones dropped
+            string names, duplicates;
+            for (Flow* flow : loaded) {
+                string name = flow->getName();
+                bool added;
+                flows.add(flow, &added);
+                if (added) {
+                    names += " " + name;
+                } else {
+                    duplicates += (duplicates.empty() ? "'" : ", '") + name + "'";
+                }
+            }
+            if (!valid) {
+                return "error '" + argument + "' has invalid flows, loaded" + names;
+            }
+            return duplicates.empty() ? "ok" + names : "error flow " + duplicates + " is already loaded";
+        }
+
+        if (command == "run") {
+            FlowRegistry::Handle loaded = flows.find(argument);
+            if (!loaded) {
+                Flow* flow;
+                {
+                    std::lock_guard<std::mutex> guard(catalogLock);
+                    flow = catalog.load(argument);
+                }
+                if (flow) {
+                    loaded = flows.add(flow);
+                }
+            }
+            if (!loaded) {
+                return "error unknown flow '" + argument + "'";
+            }
+
+            // The handle keeps the flow alive even if it is deleted meanwhile
+            std::lock_guard<std::mutex> guard(loaded->runLock);
+            return "ok " + argument + " " + to_string(timedExecute(loaded->flow.get(), mode == "parallel")) + "us";
+        }
+
+        if (command == "delete") {
+            return flows.remove(argument) ? "ok " + argument : "error unknown flow '" + argument + "'";
+        }
+
+        if (command == "list") {
+            string reply = "ok";
+            for (const FlowRegistry::Handle& entry : flows.list()) {
+                reply += " " + entry->flow->getName();
+            }
+            std::lock_guard<std::mutex> guard(catalogLock);
+            for (string_view name : catalog.names()) {
+                if (!flows.find(string(name))) {
+                    reply += " " + string(name);
+                }
+            }
+            return reply;
+        }
+
+        if (command == "save") {
+            if (catalogPath.empty()) {
+                return "error no catalog";
+            }
+
+            vector<const Flow*> loaded;
+            vector<FlowRegistry::Handle> handles = flows.list();
+            for (const FlowRegistry::Handle& entry : handles) {
+                loaded.push_back(entry->flow.get());
+            }
+
+            std::lock_guard<std::mutex> guard(catalogLock);
+            if (!FlowCatalog::save(catalogPath, loaded, &catalog) || !catalog.open(catalogPath)) {
+                return "error cannot write catalog";
+            }
+            return "ok " + to_string(catalog.size());
+        }
+
+        if (command == "metrics" || command == "trace") {
+            FlowMetrics& metrics = FlowMetrics::global();
+            if (command == "metrics" && (argument == "on" || argument == "off")) {
+                metrics.enable(argument == "on");
+            } else if (command == "metrics" && argument == "reset") {
+                metrics.reset();
+            } else if (argument.empty() || !writeMetrics(argument, command == "trace")) {
+                return "error cannot write '" + argument + "'";
+            }
+            return "ok";
+        }
+
+        if (command == "shutdown") {
+            stopping = true;
+            ::shutdown(listenFd, SHUT_RDWR);
+            return "ok";
+        }
+
+        return "error unknown command '" + command + "'";
+    }
+};
+
+// Benchmarks
+//
+// flow_project bench [--filter TEXT] [--max-steps N] [--max-file-size SIZE] [--min-time MS]
+//                    [--dir DIR] [--label TEXT] [--out FILE]
+//
+// Times every step type on its own (execute() and writeOutput() with realistic payloads),
+// whole flows of 10 steps up to --max-steps (default 100000), and the file-reading steps on
+// generated files of 1 KB up to --max-file-size (default 32M; K, M and G suffixes, up to
+// 1G). Only cases whose name contains --filter run. Every case repeats until it has run for
+// --min-time milliseconds (default 200). Step console output goes to /dev/null meanwhile;
+// the results are written as JSON to --out or stdout, so runs of different commits can be
+// compared case by case. Generated files are kept in --dir (default the current directory)
+// and reused while their size matches.
+class FlowBenchmark {
+private:
+    struct Result {
+        string name;
+        size_t bytes;           // payload size of one operation, 0 when it does not apply
+        size_t iterations;
+        double nanoseconds;     // mean per operation
+        double fastest;         // fastest operation (or batch average for tiny operations)
+    };
+
+    string filter;
+    size_t maxSteps;
+    size_t maxFileSize;
+    double minTime;
+    string directory;
+    string label;
+    string outFile;
+    vector<Result> results;
+
+    using Clock = std::chrono::steady_clock;
+
+public:
+    FlowBenchmark() : maxSteps(100000), maxFileSize(32 << 20), minTime(0.2), directory(".") {}
+
+    bool parseArguments(int argc, char* argv[]) {
+        for (int i = 2; i < argc; ++i) {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--filter") == 0 && hasValue) {
+                filter = argv[++i];
+            } else if (strcmp(argv[i], "--max-steps") == 0 && hasValue) {
+                maxSteps = strtoull(argv[++i], nullptr, 10);
+            } else if (strcmp(argv[i], "--max-file-size") == 0 && hasValue) {
+                maxFileSize = parseSize(argv[++i]);
+            } else if (strcmp(argv[i], "--min-time") == 0 && hasValue) {
+                minTime = atof(argv[++i]) / 1000;
+            } else if (strcmp(argv[i], "--dir") == 0 && hasValue) {
+                directory = argv[++i];
+            } else if (strcmp(argv[i], "--label") == 0 && hasValue) {
+                label = argv[++i];
+            } else if (strcmp(argv[i], "--out") == 0 && hasValue) {
+                outFile = argv[++i];
+            } else {
+                std::cerr << "Unknown benchmark option '" << argv[i] << "'.\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int run() {
+        // Steps print to stdout; keep the real stdout for the results only
+        cout.flush();
+        int resultsFd = dup(STDOUT_FILENO);
+        int nullFd = open("/dev/null", O_WRONLY);
+        if (resultsFd < 0 || nullFd < 0) {
+            std::cerr << "Unable to redirect the console for benchmarking.\n";
+            return 1;
+        }
+        dup2(nullFd, STDOUT_FILENO);
+        close(nullFd);
+
+        stepBenchmarks();
+        flowBenchmarks();
+        fileBenchmarks();
+
+        cout.flush();
+        dup2(resultsFd, STDOUT_FILENO);
+        close(resultsFd);
+        return writeResults() ? 0 : 1;
+    }
+
+private:
+    static size_t parseSize(const char* text) {
+        char* end;
+        size_t size = strtoull(text, &end, 10);
+        switch (toupper(*end)) {
+            case 'G': size <<= 10; [[fallthrough]];
+            case 'M': size <<= 10; [[fallthrough]];
+            case 'K': size <<= 10;
+        }
+        return size;
+    }
+
+    bool wanted(const string& name) const {
+        return name.find(filter) != string::npos;
+    }
+
+    // Time body() by the batch, each batch sized to take about a millisecond, so that
+    // operations much shorter than the clock's overhead are still measured precisely
+    template <typename Body>
+    void measure(const string& name, size_t bytes, Body body) {
+        if (!wanted(name)) {
+            return;
+        }
+
+        size_t batch = 1;
+        double elapsed = 0, fastest = 1e300;
+        size_t iterations = 0;
+        while (elapsed < minTime) {
+            auto start = Clock::now();
+            for (size_t i = 0; i < batch; ++i) {
+                body();
+            }
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            elapsed += seconds;
+            iterations += batch;
+            fastest = std::min(fastest, seconds / batch);
+            if (seconds < 1e-3 && batch < (1u << 24)) {
+                batch *= 2;
+            }
+        }
+        record(name, bytes, iterations, elapsed, fastest);
+    }
+
+    // Time body() one operation at a time, running setup() untimed before each, for
+    // operations that consume their starting state (e.g. a first run of a flow)
+    template <typename Setup, typename Body>
+    void measureEach(const string& name, size_t bytes, Setup setup, Body body) {
+        if (!wanted(name)) {
+            return;
+        }
+
+        double elapsed = 0, fastest = 1e300;
+        size_t iterations = 0;
+        while (elapsed < minTime || iterations < 3) {
+            setup();
+            auto start = Clock::now();
+            body();
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            elapsed += seconds;
+            ++iterations;
+            fastest = std::min(fastest, seconds);
+        }
+        record(name, bytes, iterations, elapsed, fastest);
+    }
+
+    void record(const string& name, size_t bytes, size_t iterations, double elapsed, double fastest) {
+        results.push_back({name, bytes, iterations, elapsed * 1e9 / iterations, fastest * 1e9});
+        std::cerr << name << ": " << iterations << " x " << (long long)(elapsed * 1e9 / iterations) << " ns\n";
+    }
+
+    // Time a step's execute() and writeOutput(), with inputs (if any) already set
+    template <typename StepType>
+    void measureStep(const string& name, size_t bytes, StepType& step, OutputSink& sink) {
+        measure("step/" + name + "/execute", bytes, [&] { step.execute(); });
+        measure("step/" + name + "/write-output", bytes, [&] {
+            step.writeOutput(sink);
+            sink.flush();
+        });
+    }
+
+    void stepBenchmarks() {
+        OutputSink sink("/dev/null");
+        const size_t rows = 1 << 20;
+
+        TitleStep title("Quarterly report", "Sales by region and product line");
+        measureStep("title", 0, title, sink);
+
+        TextStep text("Summary", string(4096, 'x'));
+        measureStep("text", 4096, text, sink);
+
+        // Answers come from a long line of words instead of the keyboard
+        string words;
+        for (int i = 0; i < 100000; ++i) {
+            words += (i ? " answer" : "answer") + to_string(i);
+        }
+        std::istringstream answers(words);
+        std::streambuf* keyboard = cin.rdbuf(answers.rdbuf());
+        TextInputStep textInput("Your name");
+        measure("step/textinput/execute", 0, [&] {
+            if (answers.peek() == EOF) {
+                answers.clear();
+                answers.seekg(0);
+                cin.clear();
+            }
+            textInput.execute();
+        });
+        measure("step/textinput/write-output", 0, [&] {
+            textInput.writeOutput(sink);
+            sink.flush();
+        });
+        cin.rdbuf(keyboard);
+        cin.clear();
+
+        NumberInputStep number("Units sold", 1234);
+        measureStep("number", 0, number, sink);
+
+        StepValue six, seven, left, right;
+        six.kind = seven.kind = StepValue::NUMBER;
+        six.number = 6;
+        seven.number = 7;
+        left.kind = right.kind = StepValue::COLUMN;
+        auto leftValues = make_shared<vector<double>>(rows), rightValues = make_shared<vector<double>>(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            (*leftValues)[i] = i * 0.5;
+            (*rightValues)[i] = i % 97 + 1;
+        }
+        left.column = leftValues;
+        right.column = rightValues;
+
+        CalculusStep calculus(0, 1, '*');
+        calculus.setInputs({&six, &seven});
+        measureStep("calculus-number", 0, calculus, sink);
+
+        CalculusStep columnCalculus(StepInput{0, StepValue::COLUMN, ""}, StepInput{1, StepValue::COLUMN, ""}, '/');
+        columnCalculus.setInputs({&left, &right});
+        measureStep("calculus-column", 2 * rows * sizeof(double), columnCalculus, sink);
+
+        auto numberKinds = [](size_t) { return StepValue::NUMBER; };
+        ExpressionStep expression("max(s0, s1) * (s0 - 1) / s1 + 2", numberKinds);
+        expression.setInputs({&six, &seven});
+        measureStep("expression-number", 0, expression, sink);
+
+        auto columnKinds = [](size_t) { return StepValue::COLUMN; };
+        ExpressionStep columnExpression("max(s0, s1) * (s0 - 1) / s1 + 2", columnKinds);
+        columnExpression.setInputs({&left, &right});
+        measureStep("expression-column", 2 * rows * sizeof(double), columnExpression, sink);
+
+        generateFiles(directory + "/bench-step", 1 << 20);
+        TextFileInputStep textFile("Notes", directory + "/bench-step");
+        measureStep("textfile", 1 << 20, textFile, sink);
+
+        OutputStep output(directory + "/bench-output.txt", "Quarterly report", "Sales by region",
+                          string(1024, 'x'));
+        measureStep("output", 1024, output, sink);
+    }
+
+    // Flow of count steps cycling through two numbers, their product and a text
+    static Flow* benchmarkFlow(size_t count) {
+        Flow* flow = new Flow("bench" + to_string(count));
+        for (size_t i = 0; i < count; ++i) {
+            switch (i % 4) {
+                case 0: flow->addStep(NumberInputStep("Units", i)); break;
+                case 1: flow->addStep(NumberInputStep("Price", 3)); break;
+                case 2: flow->addStep(CalculusStep(i - 2, i - 1, '*')); break;
+                case 3: flow->addStep(TextStep("Note", "Revenue of the line above")); break;
+            }
+        }
+        return flow;
+    }
+
+    void flowBenchmarks() {
+        OutputSink sink("/dev/null");
+        for (size_t count = 10; count <= maxSteps; count *= 10) {
+            string prefix = "flow/" + to_string(count) + "/";
+            unique_ptr<Flow> flow;
+
+            measureEach(prefix + "execute", 0, [&] { flow.reset(benchmarkFlow(count)); }, [&] { flow->execute(); });
+            measureEach(prefix + "execute-parallel", 0, [&] { flow.reset(benchmarkFlow(count)); },
+                        [&] { flow->executeParallel(); });
+
+            flow.reset(benchmarkFlow(count));
+            flow->execute();
+            measure(prefix + "execute-unchanged", 0, [&] { flow->execute(); });
+            measure(prefix + "write-output", 0, [&] {
+                flow->writeOutput(sink);
+                sink.flush();
+            });
+        }
+    }
+
+    // Write a CSV file (header, then numeric rows and a quoted label) and a text file of
+    // about size bytes each, unless they are there already
+    void generateFiles(const string& base, size_t size) const {
+        struct stat info;
+        if (stat((base + ".csv").c_str(), &info) == 0 && (size_t)info.st_size >= size &&
+            stat((base + ".txt").c_str(), &info) == 0 && (size_t)info.st_size >= size) {
+            return;
+        }
+
+        OutputSink csv(base + ".csv"), text(base + ".txt");
+        csv << "id,a,b,label\n";
+        size_t written = 13;
+        char line[96];
+        for (size_t i = 0; written < size; ++i) {
+            int length = snprintf(line, sizeof(line), "%zu,%g,%zu,\"item %zu\"\n", i, i * 0.5, i % 97 + 1, i);
+            csv.write(line, length);
+            written += length;
+        }
+        for (written = 0; written < size; written += 64) {
+            text << "The quick brown fox jumps over the lazy dog, again and again.\n\n";
+        }
+    }
+
+    void fileBenchmarks() {
+        OutputSink sink("/dev/null");
+        for (size_t size = 1 << 10; size <= maxFileSize; size <<= 5) {
+            string prefix = "file/" + to_string(size) + "/";
+            bool any = false;
+            for (const char* name : {"csvfile-execute", "flow-execute", "textfile-execute", "display-execute",
+                                     "display-write-output"}) {
+                any = any || wanted(prefix + name);
+            }
+            if (!any) {
+                continue;
+            }
+
+            string base = directory + "/bench-" + to_string(size);
+            generateFiles(base, size);
+
+            CsvFileInputStep csv("Sales", base);
+            measure(prefix + "csvfile-execute", size, [&] { csv.execute(); });
+
+            // Reading a column means parsing it, so every run starts from a new flow
+            unique_ptr<Flow> flow;
+            measureEach(prefix + "flow-execute", size, [&] {
+                flow.reset(new Flow("file"));
+                flow->addStep(CsvFileInputStep("Sales", base));
+                flow->addStep(CalculusStep(StepInput{0, StepValue::TABLE, "a"}, StepInput{0, StepValue::TABLE, "b"}, '/'));
+            }, [&] { flow->execute(); });
+
+            TextFileInputStep text("Log", base);
+            measure(prefix + "textfile-execute", size, [&] { text.execute(); });
+
+            // Display finds the text file first
+            DisplayStep display(base);
+            measure(prefix + "display-execute", size, [&] { display.execute(); });
+            measure(prefix + "display-write-output", size, [&] {
+                display.writeOutput(sink);
+                sink.flush();
+            });
+        }
+    }
+
+    bool writeResults() const {
+        unique_ptr<OutputSink> sink(outFile.empty() ? new OutputSink(STDOUT_FILENO) : new OutputSink(outFile));
+        OutputSink& out = *sink;
+        out << "{\n  \"label\": " << jsonString(label) << ",\n";
+        out.printf("  \"time\": %lld,\n  \"cpus\": %u,\n  \"results\": [\n", (long long)time(0),
+                   std::thread::hardware_concurrency());
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& result = results[i];
+            out << "    {\"name\": " << jsonString(result.name);
+            out.printf(", \"bytes\": %zu, \"iterations\": %zu, \"ns_per_op\": %.1f, \"min_ns\": %.1f",
+                       result.bytes, result.iterations, result.nanoseconds, result.fastest);
+            if (result.bytes) {
+                out.printf(", \"bytes_per_second\": %.0f", result.bytes * 1e9 / result.nanoseconds);
+            }
+            out << (i + 1 < results.size() ? "},\n" : "}\n");
+        }
+        out << "  ]\n}\n";
+        out.flush();
+        return out.isOpen();
+    }
+};
+
+// Self-checks
+//
+// flow_project selftest [--dir DIR]
+//
+// Checks the binary formats and the flow file parser without any test framework:
+// - flows saved to a catalog and loaded back step for step, merged into a second
+//   catalog, and loaded from damaged copies;
+// - a columnar sidecar of generated columns that between them take every block encoding,
+//   read back and range-searched against the values parsed from the text;
+// - key index lookups on a number and a text column against a scan of the same CSV;
+// - the errors reported for malformed flow files, formulas and report templates.
+// Failed checks are printed with what went wrong, then a count of checks run. Exits with
+// 1 if any failed. Files are generated in DIR (default a new directory under /tmp), which is
+// created if missing, and removed afterwards along with DIR if it was created.
+class FlowSelfTest {
+private:
+    string directory;
+    bool ownDirectory;
+    vector<string> files;
+    size_t checks, failures;
+
+public:
+    FlowSelfTest() : ownDirectory(false), checks(0), failures(0) {}
+
+    bool parseArguments(int argc, char* argv[]) {
+        for (int i = 2; i < argc; ++i) {
+            if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+                directory = argv[++i];
+            } else {
+                std::cerr << "Unknown selftest option '" << argv[i] << "'.\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int run() {
+        if (directory.empty()) {
+            char scratch[] = "/tmp/flow-selftest.XXXXXX";
+            if (!mkdtemp(scratch)) {
+                std::cerr << "Unable to create a directory for the self-checks.\n";
+                return 1;
+            }
+            directory = scratch;
+            ownDirectory = true;
+        } else if (mkdir(directory.c_str(), 0755) == 0) {
+            ownDirectory = true;
+        } else {
+            struct stat info;
+            if (errno != EEXIST || stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+                std::cerr << "Unable to use '" << directory << "' as the directory for the self-checks.\n";
+                return 1;
+            }
+        }
+
+        // Steps print what they do; only the failures matter here
+        std::streambuf* console = cout.rdbuf(nullptr);
+        catalogChecks();
+        sidecarChecks();
+        indexChecks();
+        parserChecks();
+        cout.rdbuf(console);
+
+        for (const string& path : files) {
+            unlink(path.c_str());
+        }
+        if (ownDirectory) {
+            rmdir(directory.c_str());
+        }
+        std::cerr << checks << " checks, " << failures << " failed\n";
+        return failures ? 1 : 0;
+    }
+
+private:
+    void expect(bool condition, const string& name, const string& detail = "") {
+        ++checks;
+        if (!condition) {
+            ++failures;
+            std::cerr << "FAIL " << name << (detail.empty() ? "" : ": " + detail) << "\n";
+        }
+    }
+
+    // Path of a generated file, removed when the checks are done
+    string scratchFile(const string& name) {
+        string path = directory + "/" + name;
+        files.push_back(path);
+        return path;
+    }
+
+    static void writeFile(const string& path, const string& text) {
+        OutputSink out(path);
+        out << text;
+    }
+
+    // Keyword, fields and creation time of every step of a flow, to compare flows by
+    static string describe(const Flow& flow) {
+        string text = flow.getName() + " " + to_string(flow.getCreationTime()) + "\n";
+        for (const AnyStep& step : flow.getSteps()) {
+            std::visit([&text](const auto& concrete) {
+                text += concrete.kindName();
+                for (const string& field : concrete.fields()) {
+                    text += "|" + field;
+                }
+                text += "\n";
+            }, step);
+        }
+        return text;
+    }
+
+    void catalogChecks() {
+        string spec = "flow every\n"
+                      "title Report \"Sales by region\"\n"
+                      "text Note \"a \\\"quoted\\\" line\"\n"
+                      "textinput Name\n"
+                      "number Units 12\n"
+                      "number Price -3\n"
+                      "calculus 3 4 *\n"
+                      "expression max(s3, s4) * (s3 - 1) / 2\n"
+                      "textfile Log notes\n"
+                      "csvfile Sales sales\n"
+                      "aggregate 8 region,product price,units @totals 16\n"
+                      "display @totals\n"
+                      "lookup 8 id few 10 20\n"
+                      "display few\n"
+                      "output \"report_{{s8.id}}.txt\" \"Report {{s5}}\" Description \"row {{row}}\"\n"
+                      "end\n"
+                      "flow small\n"
+                      "title A B\n";
+        vector<Flow*> flows;
+        vector<FlowSpecError> errors;
+        parseFlowSpecs(spec, flows, errors);
+        expect(errors.empty() && flows.size() == 2, "catalog/parse",
+               errors.empty() ? to_string(flows.size()) + " flows" : errors[0].message);
+        if (flows.size() != 2) {
+            for (Flow* flow : flows) {
+                delete flow;
+            }
+            return;
+        }
+        unique_ptr<Flow> every(flows[0]), small(flows[1]);
+
+        string path = scratchFile("flows.catalog");
+        FlowCatalog catalog;
+        expect(FlowCatalog::save(path, {every.get(), small.get()}) && catalog.open(path), "catalog/save");
+        expect(catalog.size() == 2 && catalog.contains("every") && catalog.contains("small") &&
+                   !catalog.contains("other") && catalog.names().size() == 2,
+               "catalog/names");
+        for (const Flow* original : {every.get(), small.get()}) {
+            unique_ptr<Flow> loaded(catalog.load(original->getName()));
+            expect(loaded && describe(*loaded) == describe(*original), "catalog/round-trip/" + original->getName(),
+                   loaded ? describe(*loaded) : "not loaded");
+        }
+        expect(!catalog.load("other"), "catalog/missing");
+
+        // A new version of one flow and a deleted other, merged with the first catalog
+        Flow replaced("small");
+        replaced.addStep(TextStep("Only", "step"));
+        string merged = scratchFile("merged.catalog");
+        FlowCatalog second;
+        expect(FlowCatalog::save(merged, {&replaced}, &catalog, {"every"}) && second.open(merged) &&
+                   second.size() == 1 && !second.contains("every"),
+               "catalog/merge-drop");
+        unique_ptr<Flow> reloaded(second.open(merged) ? second.load("small") : nullptr);
+        expect(reloaded && describe(*reloaded) == describe(replaced), "catalog/merge-replace");
+
+        // Records carried over without being decoded still load
+        string copied = scratchFile("copied.catalog");
+        FlowCatalog third;
+        expect(FlowCatalog::save(copied, {}, &catalog) && third.open(copied) && third.size() == 2, "catalog/carry");
+        unique_ptr<Flow> carried(third.size() ? third.load("every") : nullptr);
+        expect(carried && describe(*carried) == describe(*every), "catalog/carry-round-trip");
+
+        // Truncated catalogs do not open; a byte changed anywhere may break a flow but
+        // never the reader
+        MappedFile original(path);
+        string bytes(original.data(), original.size());
+        string damaged = scratchFile("damaged.catalog");
+        std::streambuf* errorConsole = std::cerr.rdbuf(nullptr);
+        bool truncatedOpened = false;
+        for (size_t length : {(size_t)0, (size_t)7, (size_t)31, bytes.size() / 2, bytes.size() - 1}) {
+            writeFile(damaged, bytes.substr(0, length));
+            FlowCatalog truncated;
+            truncatedOpened = truncatedOpened || truncated.open(damaged);
+        }
+
+        size_t loads = 0;
+        for (size_t i = 32; i < bytes.size(); ++i) {
+            string changed = bytes;
+            changed[i] ^= 0xff;
+            writeFile(damaged, changed);
+            FlowCatalog corrupt;
+            if (corrupt.open(damaged)) {
+                for (string_view name : corrupt.names()) {
+                    delete corrupt.load(name);
+                    ++loads;
+                }
+                delete corrupt.load("every");
+            }
+        }
+        std::cerr.rdbuf(errorConsole);
+        expect(!truncatedOpened, "catalog/truncated");
+        expect(loads > 0, "catalog/damaged-bytes");
+    }
+
+    // Sidecar of a CSV of n rows spanning several blocks: raw doubles, integers with small
+    // deltas, runs of doubles, a sparse column, dictionary codes (some quoted), runs of
+    // codes, and text that is only partly numeric
+    void sidecarChecks() {
+        const size_t n = 150000;
+        vector<string> names = {"raw", "delta", "runs", "sparse", "city", "group", "mixed"};
+        vector<vector<double>> expected(names.size());
+        string csv = "raw,delta,runs,sparse,city,group,mixed\n";
+        char line[256];
+        for (size_t i = 0; i < n; ++i) {
+            string city = i % 97 == 0 ? "\"New \"\"York\"\", NY\"" : "city" + to_string(i % 50);
+            string mixed = i % 3 ? to_string(i % 11) : "n/a";
+            snprintf(line, sizeof(line), "%.17g,%lld,%g,%s,%s,grp%zu,%s\n", std::sqrt((double)i) * 1.37,
+                     (long long)(i * 3) - (long long)(i % 7) - 200000, (double)(i / 1000) * 0.5,
+                     i % 5 ? to_string(i % 13).c_str() : "", city.c_str(), i / 5000, mixed.c_str());
+            csv += line;
+        }
+        string path = scratchFile("sidecar.csv");
+        scratchFile("sidecar.csv.cols");
+        writeFile(path, csv);
+
+        CsvReader reader(path);
+        reader.nextRow();
+        while (reader.nextRow()) {
+            for (size_t c = 0; c < names.size(); ++c) {
+                string_view field = reader.fields()[c];
+                string unquoted = reader.isQuoted(c) ? CsvReader::unquote(field) : string(field);
+                expected[c].push_back(CsvReader::parseNumber(unquoted));
+            }
+        }
+
+        auto same = [](const vector<double>& a, const vector<double>& b) {
+            if (a.size() != b.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < a.size(); ++i) {
+                if (!(a[i] == b[i] || (std::isnan(a[i]) && std::isnan(b[i])))) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        for (int pass = 0; pass < 2; ++pass) {
+            // The first pass writes the sidecar, the second opens it
+            string prefix = pass ? "sidecar/open/" : "sidecar/write/";
+            shared_ptr<const ColumnStore> store = ColumnStore::forCsv(path);
+            expect(store && store->getHeader() == names && store->rowCount() == n, prefix + "header");
+            if (!store || store->getHeader() != names) {
+                return;
+            }
+            for (size_t c = 0; c < names.size(); ++c) {
+                expect(store->type(c) == (c < 4 ? ColumnStore::NUMBER : ColumnStore::TEXT), prefix + names[c] + "/type");
+                vector<double> values;
+                store->readNumbers(c, values);
+                expect(same(values, expected[c]), prefix + names[c] + "/values");
+
+                for (auto range : {pair<double, double>{0, 10}, {-199990, -150000}, {37.5, 37.5}, {400, 500}}) {
+                    vector<uint64_t> found = store->rowsBetween(c, range.first, range.second), scanned;
+                    for (size_t i = 0; i < n; ++i) {
+                        if (expected[c][i] >= range.first && expected[c][i] <= range.second) {
+                            scanned.push_back(i);
+                        }
+                    }
+                    expect(found == scanned, prefix + names[c] + "/between " + to_string(range.first));
+                }
+            }
+        }
+
+        // A changed CSV is converted again
+        OutputSink append(::open(path.c_str(), O_WRONLY | O_APPEND));
+        append << "1,2,3,4,city1,grp0,5\n";
+        append.flush();
+        ::close(append.descriptor());
+        shared_ptr<const ColumnStore> changed = ColumnStore::forCsv(path);
+        expect(changed && changed->rowCount() == n + 1, "sidecar/rebuild");
+    }
+
+    // Index lookups against a scan, on a number column with duplicates and missing keys
+    // and on a text column with quoted keys
+    void indexChecks() {
+        const size_t n = 20000;
+        string path = scratchFile("indexed.csv");
+        scratchFile("indexed.csv.id.idx");
+        scratchFile("indexed.csv.name.idx");
+
+        string csv = "id,name,row\n";
+        vector<pair<string, double>> rows; // row text and numeric key
+        vector<string> names;
+        for (size_t i = 0; i < n; ++i) {
+            string id = i % 101 == 0 ? "" : to_string((i * 7919) % 1000) + (i % 2 ? "" : ".5");
+            string name = "n" + to_string((i * 31) % 500);
+            string field = i % 7 == 0 ? "\"" + name + ", \"\"q\"\"\"" : name;
+            names.push_back(i % 7 == 0 ? name + ", \"q\"" : name);
+            string row = id + "," + field + "," + to_string(i);
+            rows.push_back({row, id.empty() ? std::numeric_limits<double>::quiet_NaN() : CsvReader::parseNumber(id)});
+            csv += row + "\n";
+        }
+        writeFile(path, csv);
+
+        CsvIndex ids;
+        expect(ids.open(path, "id", 0) && ids.isNumeric() && ids.rowCount() == n - (n + 100) / 101, "index/id/open");
+        for (auto range : {pair<double, double>{5, 5}, {5.5, 5.5}, {100, 200}, {-10, 1e9}, {2000, 3000}, {7, 3}}) {
+            vector<uint64_t> offsets;
+            ids.offsetsBetween(range.first, range.second, offsets);
+            vector<string> found, scanned;
+            for (uint64_t offset : offsets) {
+                found.push_back(string(ids.rowAt(offset)));
+            }
+            for (const auto& row : rows) {
+                if (row.second >= range.first && row.second <= range.second) {
+                    scanned.push_back(row.first);
+                }
+            }
+            bool ordered = true;
+            for (size_t i = 1; i < found.size(); ++i) {
+                ordered = ordered && CsvReader::parseNumber(found[i - 1].substr(0, found[i - 1].find(','))) <=
+                                         CsvReader::parseNumber(found[i].substr(0, found[i].find(',')));
+            }
+            sort(found.begin(), found.end());
+            sort(scanned.begin(), scanned.end());
+            expect(found == scanned && ordered, "index/id/between " + to_string(range.first),
+                   to_string(found.size()) + " rows, expected " + to_string(scanned.size()));
+        }
+
+        CsvIndex texts;
+        expect(texts.open(path, "name", 1) && !texts.isNumeric() && texts.rowCount() == n, "index/name/open");
+        for (auto range : {pair<string, string>{"n42", "n42"}, {"n42, \"q\"", "n42, \"q\""}, {"n1", "n2"}, {"x", "y"}}) {
+            vector<uint64_t> offsets;
+            texts.offsetsBetween(string_view(range.first), string_view(range.second), offsets);
+            size_t scanned = 0;
+            for (const string& name : names) {
+                scanned += name >= range.first && name <= range.second;
+            }
+            expect(offsets.size() == scanned, "index/name/between " + range.first,
+                   to_string(offsets.size()) + " rows, expected " + to_string(scanned));
+        }
+
+        // An index is built again once the CSV changes
+        OutputSink append(::open(path.c_str(), O_WRONLY | O_APPEND));
+        append << "5,n5,extra\n";
+        append.flush();
+        ::close(append.descriptor());
+        CsvIndex rebuilt;
+        vector<uint64_t> before, after;
+        ids.offsetsBetween(5.0, 5.0, before);
+        expect(rebuilt.open(path, "id", 0), "index/rebuild/open");
+        rebuilt.offsetsBetween(5.0, 5.0, after);
+        expect(after.size() == before.size() + 1, "index/rebuild");
+    }
+
+    // Each malformed text and the line and part of the message of its first error
+    void parserChecks() {
+        struct Case {
+            const char* text;
+            size_t line;
+            const char* message;
+        };
+        const Case cases[] = {
+            {"title a b\n", 1, "'title' outside a flow"},
+            {"end\n", 1, "'end' outside a flow"},
+            {"flow\n", 1, "missing flow name"},
+            {"flow a\nflow a\n", 2, "is defined twice"},
+            {"flow a\nbogus x\n", 2, "unknown step 'bogus'"},
+            {"flow a\ntitle only\n", 2, "'title' needs 2 argument(s)"},
+            {"flow a\ntext a \"unterminated\n", 2, "unterminated quoted field"},
+            {"flow a\nnumber n 12x\n", 2, "'12x' is not a whole number"},
+            {"flow a\nnumber n 99999999999\n", 2, "is not a whole number"},
+            {"flow a\ntitle a b\ncalculus 0 0 +\n", 3, "is not an earlier number"},
+            {"flow a\nnumber n 1\nnumber m 2\ncalculus 0 1 %\n", 4, "is not an operation"},
+            {"flow a\nnumber n 1\nexpression s0 +\n", 3, "unexpected end of formula"},
+            {"flow a\nnumber n 1\nexpression (s0 + 1\n", 3, "missing ')'"},
+            {"flow a\nnumber n 1\nexpression foo(s0)\n", 3, "unknown name 'foo'"},
+            {"flow a\nexpression s99999999999999999999999 + 1\n", 2, "is too large"},
+            {"flow a\ntitle a b\nexpression s0 * 2\n", 3, "does not produce a number or column"},
+            {"flow a\ncsvfile d data\naggregate 0 k v out 0\n", 3, "is not a memory budget"},
+            {"flow a\ncsvfile d data\naggregate 0 k v out 99999999999999999999\n", 3, "is not a memory budget"},
+            {"flow a\ntitle t u\nlookup 0 id out 1\n", 3, "is not an earlier CSV step"},
+            {"flow a\ncsvfile d data\naggregate 0 k v @s\n", 3, "is never read"},
+            {"flow a\ncsvfile d data\naggregate 0 k v @s\ndisplay @s\ndisplay @s\n", 5, "is already read"},
+            {"flow a\ndisplay @nothing\n", 2, "is not the stream of an earlier step"},
+            {"flow a\noutput f T \"{{s1\"\n", 2, "unterminated placeholder"},
+            {"flow a\noutput f T \"{{x}}\"\n", 2, "unknown placeholder"},
+            {"flow a\noutput f T \"{{s99999999999999999999999}}\"\n", 2, "is too large"},
+            {"flow a\noutput f T \"{{s0}}\"\n", 2, "does not refer to an earlier step"},
+        };
+        for (const Case& test : cases) {
+            vector<Flow*> flows;
+            vector<FlowSpecError> errors;
+            parseFlowSpecs(test.text, flows, errors);
+            string first = errors.empty() ? "no error" : to_string(errors[0].line) + ": " + errors[0].message;
+            expect(!errors.empty() && errors[0].line == test.line &&
+                       errors[0].message.find(test.message) != string::npos,
+                   string("parser/") + test.message, first);
+            for (Flow* flow : flows) {
+                delete flow;
+            }
+        }
+
+        // Formulas deep enough to overflow the stack are refused instead
+        const pair<string, const char*> deepCases[] = {
+            {string(100000, '(') + "s0" + string(100000, ')'), "formula nested too deeply"},
+            {string(100000, '-') + "s0", "formula nested too deeply"},
+            {[] { string sum = "s0"; for (int i = 0; i < 100000; ++i) sum += "+s0"; return sum; }(), "formula too long"},
+        };
+        for (const auto& [formula, message] : deepCases) {
+            vector<Flow*> flows;
+            vector<FlowSpecError> errors;
+            parseFlowSpecs("flow a\nnumber n 1\nexpression " + formula + "\n", flows, errors);
+            string first = errors.empty() ? "no error" : to_string(errors[0].line) + ": " + errors[0].message;
+            expect(!errors.empty() && errors[0].message.find(message) != string::npos, string("parser/") + message,
+                   first);
+            for (Flow* flow : flows) {
+                delete flow;
+            }
+        }
+
+        // The flows around one with an error still load
+        vector<Flow*> flows;
+        vector<FlowSpecError> errors;
+        parseFlowSpecs("flow a\ntitle a b\nflow b\nbogus\nflow c\ntitle c d\n", flows, errors);
+        expect(flows.size() == 2 && errors.size() == 1 && errors[0].line == 4, "parser/neighbours");
+        for (Flow* flow : flows) {
+            delete flow;
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "run") == 0) {
+        return runBatch(argc, argv);
+    }
+
+    if (argc > 2 && strcmp(argv[1], "daemon") == 0) {
+        FlowDaemon daemon(argv[2], argc > 3 ? argv[3] : "");
+        return daemon.serve();
+    }
+
+    if (argc > 1 && strcmp(argv[1], "catalog") == 0) {
+        return updateCatalog(argc, argv);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "dataset") == 0) {
+        return runDataset(argc, argv);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "check") == 0) {
+        return checkFlowFiles(argc, argv);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "shard") == 0) {
+        return runSharded(argc, argv);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        FlowBenchmark benchmark;
+        return benchmark.parseArguments(argc, argv) ? benchmark.run() : 1;
+    }
+    if (argc > 1 && strcmp(argv[1], "selftest") == 0) {
+        FlowSelfTest selfTest;
+        return selfTest.parseArguments(argc, argv) ? selfTest.run() : 1;
+    }
+
+    int choice;
+    FlowRegistry existingFlows; // Flow-urile existente, indexate după nume
+
+    // Flows built in earlier sessions are kept in a catalog next to the program. Only their
+    // names are read up front; a flow is built from the catalog when it is first chosen.
+    const string catalogFile = "flows.catalog";
+    FlowCatalog catalog;
+    catalog.open(catalogFile);
+    vector<string> deletedFlows; // catalog flows deleted in this session
+
+    // Names of the flows in this session, then the catalog flows not loaded or deleted yet
+    auto flowNames = [&]() {
+        vector<string> names;
+        for (const FlowRegistry::Handle& entry : existingFlows.list()) {
+            names.push_back(entry->flow->getName());
+        }
+        for (string_view name : catalog.names()) {
+            string catalogName(name);
+            if (!existingFlows.find(catalogName) &&
+                std::find(deletedFlows.begin(), deletedFlows.end(), catalogName) == deletedFlows.end()) {
+                names.push_back(catalogName);
+            }
+        }
+        return names;
+    };
+
+invalid_option:
+    while (1)
+    {
+        cout << "To use an existing flow, press 1; to create a new one, press 2; to delete a flow, press 3; and to exit, press 4: ";
+        cin >> choice;
+        switch (choice) {
+            case 1:
+            {
+                vector<string> flows = flowNames();
+                if (flows.empty()) {
+                    cout << "There are no available flows for use.\n";
+                } else {
+                    cout << "Choose an existing flow:\n";
+                    for (size_t i = 0; i < flows.size(); ++i) {
+                        cout << i + 1 << ". " << flows[i] << "\n";
+                    }
+                    int chosenFlow;
+                    cin >> chosenFlow;
+                    if (chosenFlow > 0 && chosenFlow <= flows.size()) {
+                        FlowRegistry::Handle entry = existingFlows.find(flows[chosenFlow - 1]);
+                        if (!entry) {
+                            Flow* loaded = catalog.load(flows[chosenFlow - 1]);
+                            entry = loaded ? existingFlows.add(loaded) : nullptr;
+                        }
+                        if (entry) {
+                            std::lock_guard<std::mutex> guard(entry->runLock);
+                            entry->flow->execute();
+                        }
+                    } else {
+                        cout << "Invalid option.\n";
+                    }
+                }
+                break;
+            }
+            case 2:
+            {
+                cout << "Create a new flow.\n";
+                Flow* newFlow;
+
+                char inputLine[100];
+                int nrSteps = 9;
+                char flowName[50];
+
+                cout << "Please enter the flow name:";
+                cin >> flowName;
+                if (existingFlows.find(flowName) ||
+                    (catalog.contains(flowName) &&
+                     std::find(deletedFlows.begin(), deletedFlows.end(), string(flowName)) == deletedFlows.end())) {
+                    cout << "A flow named '" << flowName << "' already exists.\n";
+                    break;
+                }
+                newFlow = new Flow(flowName); // Alocăm un nou flow dinamic
+                cout << "Available step types: title, text, number, calculation, textfile, csvfile, output, displaytxt, displaycsv, end" << endl;
+                
+                cout << "Do you want to add a title step?" << endl;
+                cout << "1. Add a new title step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                
+                int choice;
+                cin >> choice;
+                if (choice == 1) {
+                    string title, subtitle;
+                    cout << "Enter title: ";
+                    cin >> title;
+                    cout << "Enter subtitle: ";
+                    cin >> subtitle;
+                    // luam flowul nou creat, ii luam vector de steps deja existent, adaugam noul step cerut de utilizator in el
+                    newFlow->addStep(TitleStep(title, subtitle));
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+
+                cout << "Do you want to add a text step?" << endl;
+                cout << "1. Add a new text step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                cin >> choice;
+
+                if (choice == 1) {
+                    string title, copy;
+                    cout << "Enter title: ";
+                    cin >> title;
+                    cout << "Enter text copy: ";
+                    cin >> copy;
+                    newFlow->addStep(TextStep(title, copy));
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+
+                cout << "Do you want to add a number step?" << endl;
+                cout << "1. Add a new number step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                cin >> choice;
+
+                if (choice == 1) {
+                    string description;
+                    float num;
+                    cout << "Enter number description: ";
+                    cin >> description;
+                    cout << "Enter a number: ";
+                    cin >> num;
+                    // (*newFlow).getSteps()
+                    newFlow->addStep(NumberInputStep(description, num));
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+
+                cout << "Do you want to add a number step?" << endl;
+                cout << "1. Add a new number step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                cin >> choice;
+
+                if (choice == 1) {
+                    string description;
+                    float num;
+                    cout << "Enter number description: ";
+                    cin >> description;
+                    cout << "Enter a number: ";
+                    cin >> num;
+                    // (*newFlow).getSteps()
+                    newFlow->addStep(NumberInputStep(description, num));
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+
+                cout << "Do you want to add a calculus step?" << endl;
+                cout << "1. Add a new calculus step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                cin >> choice;
+
+                if (choice == 1) {
+                    int steps[3];
+                    char operation;
+                    cout << "Enter number of steps: ";
+                    for (int i = 0; i < 2; i++) {
+                        cout << "Number of the " << i << " step:" << endl;
+                        cin >> steps[i];
+                    }
+
+                    bool numeric = true;
+                    for (int i = 0; i < 2; i++) {
+                        numeric = numeric && steps[i] >= 0 && steps[i] < (int)newFlow->stepCount() &&
+                                  newFlow->stepOutputKind(steps[i]) == StepValue::NUMBER;
+                    }
+                    
+                    cout << "Enter operation (e.g., '+' for Addition, '-' for Subtraction, etc...): ";
+                    cin >> operation;
+                    //calculusStep->execute();
+                    if (numeric) {
+                        newFlow->addStep(CalculusStep(steps[0], steps[1], operation));
+                    } else {
+                        cout << "Both steps must be number steps, skipping calculus step.\n";
+                    }
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+
+                cout << "Do you want to add a text file step?" << endl;
+                cout << "1. Add a new text file step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                cin >> choice;
+
+                if (choice == 1) {
+                    string desc, fileName;
+                    cout << "Enter file description: ";
+                    cin >> desc;
+                    cout << "Enter file name: ";
+                    cin >> fileName;
+                    newFlow->addStep(TextFileInputStep(desc, fileName));
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+
+                cout << "Do you want to add a CSV file step?" << endl;
+                cout << "1. Add a new CSV file step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                cin >> choice;
+
+                if (choice == 1) {
+                    string desc, fileName;
+                    cout << "Enter CSV description: ";
+                    cin >> desc;
+                    cout << "Enter CSV file name: ";
+                    cin >> fileName;
+                    newFlow->addStep(CsvFileInputStep(desc, fileName));
+                    size_t csvStep = newFlow->stepCount() - 1;
+
+                    cout << "Do you want to add an aggregate step over this CSV?" << endl;
+                    cout << "1. Add a new aggregate step" << endl;
+                    cout << "2. Skip step" << endl;
+                    cin >> choice;
+                    if (choice == 1) {
+                        string keys, values, outName;
+                        cout << "Enter key columns (comma-separated): ";
+                        cin >> keys;
+                        cout << "Enter value columns (comma-separated): ";
+                        cin >> values;
+                        cout << "Enter output file name: ";
+                        cin >> outName;
+                        newFlow->addStep(AggregateStep({csvStep, StepValue::TABLE, ""}, keys, values, outName));
+                    }
+
+                    cout << "Do you want to add a lookup step over this CSV?" << endl;
+                    cout << "1. Add a new lookup step" << endl;
+                    cout << "2. Skip step" << endl;
+                    cin >> choice;
+                    if (choice == 1) {
+                        string column, outName, first, last;
+                        cout << "Enter key column: ";
+                        cin >> column;
+                        cout << "Enter output file name: ";
+                        cin >> outName;
+                        cout << "Enter first key: ";
+                        cin >> first;
+                        cout << "Enter last key (- for a single key): ";
+                        cin >> last;
+                        newFlow->addStep(LookupStep(csvStep, column, outName, first, last == "-" ? "" : last));
+                    }
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+
+                cout << "Do you want to add a displaytxt/displaycsv step?" << endl;
+                cout << "1. Add a new display step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                cin >> choice;
+
+                if (choice == 1) {
+                    string fName;
+                    cout << "Enter file name to display: ";
+                    cin >> fName;
+                    newFlow->addStep(DisplayStep(fName));
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+
+                cout << "Do you want to add an output step?" << endl;
+                cout << "1. Add a new output step" << endl;
+                cout << "2. Skip step" << endl;
+                cout << "3. End" << endl;
+                cin >> choice;
+
+                if (choice == 1) {
+                    int stepNum;
+                    string outFile, outTitle, outDesc, outInfo;
+                    cout << "Enter output file name: ";
+                    cin >> outFile;
+                    cout << "Enter output title: ";
+                    cin >> outTitle;
+                    cout << "Enter output description: ";
+                    cin >> outDesc;
+                    cout << "Enter output information ({{sN}} inserts the result of step N): ";
+                    cin >> outInfo;
+                    
+                    OutputSink file(outFile);
+                    newFlow->writeOutput(file);
+                    OutputStep output(outFile, outTitle, outDesc, outInfo, [&](size_t position) {
+                        return position < newFlow->stepCount() ? newFlow->stepOutputKind(position) : StepValue::NONE;
+                    });
+                    if (output.isValid()) {
+                        newFlow->addStep(std::move(output));
+                    } else {
+                        cout << "Invalid output step: " << output.error() << endl;
+                    }
+                } else if (choice == 2) {
+                    cout << "Skipping step...\n";
+                } else if (choice == 3) {
+                    existingFlows.add(newFlow);
+                    break;
+                }
+                
+                existingFlows.add(newFlow); // Adăugăm flow-ul nou creat în registrul de flow-uri existente
+                break;
+            }
+            case 3:
+            {
+                vector<string> flows = flowNames();
+                if (flows.empty()) {
+                    cout << "There are no flows to be deleted.\n";
+                } else {
+                    cout << "Choose a flow to delete it:\n";
+                    for (size_t i = 0; i < flows.size(); ++i) {
+                        cout << i + 1 << ". " << flows[i] << "\n";
+                    }
+                    int deleteFlow;
+                    cin >> deleteFlow;
+                    if (deleteFlow > 0 && deleteFlow <= flows.size()) {
+                        existingFlows.remove(flows[deleteFlow - 1]); // Flow-ul e eliberat odată cu ultimul handle
+                        if (catalog.contains(flows[deleteFlow - 1])) {
+                            deletedFlows.push_back(flows[deleteFlow - 1]);
+                        }
+                        cout << "The flow has been successfully deleted.\n";
+                    } else {
+                        cout << "Invalid option.\n";
+                    }
+                }
+            }
+        }
+
+        if (choice == 4) {
+            cout << "Exit..\n";
+            vector<const Flow*> flows;
+            for (const FlowRegistry::Handle& entry : existingFlows.list()) {
+                flows.push_back(entry->flow.get());
+            }
+            // Merge with the catalog so flows never loaded in this session are kept
+            FlowCatalog::save(catalogFile, flows, &catalog, deletedFlows);
+            break;
+        }
+
+        if (choice > 4 || choice <= 0) {
+            cout << "Invalid option, choose again.\n";
+            goto invalid_option;
+        }
+    }
+
+
+    return 0;
 }
\ No newline at end of file